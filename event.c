@@ -0,0 +1,120 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "event.h"
+
+// Description of the wait, kept on the waiting task's stack
+struct EVENT_WAIT {
+	uint32_t mask;
+	uint8_t options;
+	uint32_t flags;		// flags which satisfied the wait
+};
+
+/*
+ * Check whether the flags satisfy the wait condition
+ */
+static uint8_t event_is_satisfied(uint32_t flags, uint32_t mask, uint8_t options)
+{
+	if (options & EVENT_WAIT_ALL) {
+		return ((flags & mask) == mask) ? TRUE : FALSE;
+	}
+	return ((flags & mask) != 0) ? TRUE : FALSE;
+}
+
+/*
+ * Wait until any (EVENT_WAIT_ANY) or all (EVENT_WAIT_ALL) the flags in mask are set, for
+ * at most timeout ticks. With EVENT_CLEAR_ON_EXIT the awaited flags are cleared once the
+ * wait is satisfied. The value of the flags which satisfied the wait (before clearing)
+ * is returned in flags, if not NULL.
+ * From interrupt handlers it never blocks.
+ * Returns KERNEL_OK or KERNEL_TIMEOUT.
+ */
+int32_t kernel_event_wait(struct EVENT_GROUP* group, uint32_t mask, uint8_t options, uint32_t* flags, uint32_t timeout)
+{
+	struct EVENT_WAIT wait;
+	int32_t ret;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (event_is_satisfied(group->flags, mask, options)) {
+		if (flags != NULL) {
+			*flags = group->flags;
+		}
+		if (options & EVENT_CLEAR_ON_EXIT) {
+			group->flags &= ~mask;
+		}
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	if ((timeout == NO_WAIT) || kernel_is_in_interrupt()) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_TIMEOUT;
+	}
+	
+	wait.mask = mask;
+	wait.options = options;
+	wait.flags = 0;
+	kernel_get_active_task()->wait_data = &wait;
+	ret = kernel_wait_on_list(&group->waiting_tasks_list, timeout, irq_state);
+	if ((ret == KERNEL_OK) && (flags != NULL)) {
+		*flags = wait.flags;
+	}
+	return ret;
+}
+
+/*
+ * Set the flags in mask and wake up, in a single pass, all the tasks whose wait is now 
+ * satisfied. The flags requested with EVENT_CLEAR_ON_EXIT are cleared only after all
+ * the waiting tasks have been checked, so that a single event can wake several tasks.
+ * This can be called from interrupt handlers.
+ * Returns the value of the flags after the operation.
+ */
+uint32_t kernel_event_set(struct EVENT_GROUP* group, uint32_t mask)
+{
+	struct TASK* task_ptr;
+	struct TASK* next_task_ptr;
+	struct EVENT_WAIT* wait;
+	uint32_t flags_to_clear = 0;
+	uint32_t flags;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	group->flags |= mask;
+	task_ptr = group->waiting_tasks_list;
+	while (task_ptr != NULL) {
+		next_task_ptr = task_ptr->next_task;
+		wait = (struct EVENT_WAIT*)task_ptr->wait_data;
+		if (event_is_satisfied(group->flags, wait->mask, wait->options)) {
+			wait->flags = group->flags;
+			if (wait->options & EVENT_CLEAR_ON_EXIT) {
+				flags_to_clear |= wait->mask;
+			}
+			kernel_wake_up_task(task_ptr, KERNEL_OK);
+		}
+		task_ptr = next_task_ptr;
+	}
+	group->flags &= ~flags_to_clear;
+	flags = group->flags;
+	kernel_exit_critical(irq_state);
+	return flags;
+}
+
+/*
+ * Clear the flags in mask. This can be called from interrupt handlers.
+ * Returns the value of the flags after the operation.
+ */
+uint32_t kernel_event_clear(struct EVENT_GROUP* group, uint32_t mask)
+{
+	uint32_t flags;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	group->flags &= ~mask;
+	flags = group->flags;
+	kernel_exit_critical(irq_state);
+	return flags;
+}
+
+/*
+ * Return the current value of the flags
+ */
+uint32_t kernel_event_get(struct EVENT_GROUP* group)
+{
+	return group->flags;
+}
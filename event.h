@@ -0,0 +1,28 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+// Wait options
+#define EVENT_WAIT_ANY			0x00	// wait until at least one of the flags is set
+#define EVENT_WAIT_ALL			0x01	// wait until all the flags are set
+#define EVENT_CLEAR_ON_EXIT		0x02	// clear the awaited flags once the wait is satisfied
+
+struct EVENT_GROUP {
+	uint32_t flags;
+	struct TASK* waiting_tasks_list;	// tasks waiting for some flags (ordered based on priority)
+};
+
+#define ALLOCATE_EVENT_GROUP(_name_)	\
+	struct EVENT_GROUP _name_ = {	\
+		.flags = 0,	\
+		.waiting_tasks_list = NULL,	\
+	};
+
+int32_t kernel_event_wait(struct EVENT_GROUP* group, uint32_t mask, uint8_t options, uint32_t* flags, uint32_t timeout);
+uint32_t kernel_event_set(struct EVENT_GROUP* group, uint32_t mask);
+uint32_t kernel_event_clear(struct EVENT_GROUP* group, uint32_t mask);
+uint32_t kernel_event_get(struct EVENT_GROUP* group);
+
+#endif // _EVENT_H_
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "tlsf.h"
+#include "heap.h"
+
+// The heap's arena is defined in the linker file
+extern uint32_t _sheap;
+extern uint32_t _eheap;
+
+// Private variables
+struct TLSF heap;
+
+/*
+ * The heap is set up on its first use, so that it can be used by any module's 
+ * initialization function. Must be called inside a critical section.
+ */
+static void heap_check_init()
+{
+	if (heap.total_size == 0) {
+		tlsf_init(&heap, &_sheap, (uint32_t)&_eheap - (uint32_t)&_sheap);
+	}
+}
+
+/*
+ * Allocate size bytes from the heap in constant time. This can be called from interrupt handlers.
+ * Returns NULL if there's no large enough free block.
+ */
+void* kernel_malloc(uint32_t size)
+{
+	void* ptr;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	heap_check_init();
+	ptr = tlsf_malloc(&heap, size);
+	kernel_exit_critical(irq_state);
+	return ptr;
+}
+
+/*
+ * Give the memory back to the heap in constant time. This can be called from interrupt handlers.
+ */
+void kernel_free(void* ptr)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	tlsf_free(&heap, ptr);
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Get the usage and fragmentation statistics of the heap
+ */
+void kernel_heap_get_stats(struct TLSF_STATS* stats)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	heap_check_init();
+	tlsf_get_stats(&heap, stats);
+	kernel_exit_critical(irq_state);
+}
@@ -0,0 +1,11 @@
+#ifndef _HEAP_H_
+#define _HEAP_H_
+
+#include "stdint.h"
+#include "tlsf.h"
+
+void* kernel_malloc(uint32_t size);
+void kernel_free(void* ptr);
+void kernel_heap_get_stats(struct TLSF_STATS* stats);
+
+#endif // _HEAP_H_
\ No newline at end of file
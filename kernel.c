@@ -3,15 +3,67 @@
 #include "stm32f103xb.h"
 #include "kernel.h"
 #include "debug_printf.h"
+#include "clock.h"
+#include "mempool.h"
+#include "mutex.h"
 
 #define debug_msg(_format_, ...)	DebugPrintf("[Kernel] " _format_, ##__VA_ARGS__)
 
 // Private variables
 uint32_t tasks_count = 0;
-struct TASK* active_tasks_list = NULL;  // list of active tasks (ordered based on priority)
+struct TASK* ready_tasks_lists[KERNEL_PRIORITY_LEVELS];  // one FIFO list of ready tasks for each priority level
+struct TASK* ready_tasks_lists_tail[KERNEL_PRIORITY_LEVELS];  // last task of each ready list (for O(1) insertion)
+uint32_t ready_priorities_bitmap = 0;  // bit (31-N) is set when the ready list of priority N is not empty
+#define PRIORITY_BIT(_priority_)	(0x80000000UL >> (_priority_))
+struct TASK* timer_queue = NULL;  // list of sleeping tasks (ordered based on their expiration time)
 struct TASK* dead_tasks_list = NULL;  // list of dead tasks (this is not ordered, of course)
+struct TASK* initialized_tasks_list = NULL;  // all the tasks passed to kernel_init_task() (plus the idle task)
 struct TASK* active_task = NULL;  // pointer to the current active task (NULL if there's no active task)
-ALLOCATE_TASK(kernel, 1024, 0, NULL)  // This is the stack used for the kernel
+uint32_t cycle_count_high = 0;  // upper 32 bits of the 64 bits cycle counter
+uint32_t last_cycle_count = 0;  // DWT cycle counter value sampled at the last tick
+void (*idle_hook)(void) = NULL;  // user function called by the idle task before going to sleep
+uint8_t (*stack_overflow_hook)(struct TASK* task_ptr) = NULL;  // user function which decides what to do with a task which overflowed its stack
+#define STACK_PATTERN 		0xAAAAAAAAUL  // pattern word used to fill the stacks (the bottom word is also the guard word)
+#define task_stack_bottom(_task_)	((_task_)->descriptor->stack_top - (_task_)->descriptor->stack_size + 1)
+
+// CPU load measurement
+uint32_t cycles_per_tick;
+uint32_t idle_cycles = 0;  // cycles spent in the idle task during the current sample period
+uint32_t idle_switch_in_cycles = 0;  // cycle counter value when the idle task was switched in
+uint32_t load_sample_start_cycles = 0;  // cycle counter value at the beginning of the current sample period
+uint32_t load_sample_ticks = 0;  // ticks elapsed in the current sample period
+uint16_t cpu_load_history[KERNEL_CPU_LOAD_HISTORY];  // load of the last seconds in 1/1000 (circular buffer)
+uint8_t cpu_load_history_index = 0;  // next sample to be written
+uint8_t cpu_load_history_count = 0;  // number of valid samples
+
+// Wakeups requested by interrupt handlers, processed by the PendSV handler
+#define PENDING_WAKEUP_ACTIVATE		0xFF	// any other type is a notification mode
+struct PENDING_WAKEUP {
+	struct TASK* task;
+	uint32_t value;
+	uint8_t type;
+	volatile uint8_t valid;	// set once the slot has been filled, cleared when it is processed
+};
+struct PENDING_WAKEUP pending_wakeups[KERNEL_PENDING_WAKEUPS];
+volatile uint32_t pending_wakeups_write = 0;  // incremented by the interrupt handlers (lock-free)
+uint32_t pending_wakeups_read = 0;  // incremented by the PendSV handler only
+// Control blocks and stacks of the tasks created at runtime. Their descriptors can't be 
+// in flash, so they are allocated together with the control blocks.
+struct DYNAMIC_TASK {
+	struct TASK task;
+	struct TASK_DESCRIPTOR descriptor;
+};
+ALLOCATE_MEMPOOL(task_pool, sizeof(struct DYNAMIC_TASK), KERNEL_MAX_DYNAMIC_TASKS)
+ALLOCATE_MEMPOOL(stack_pool_small, KERNEL_STACK_SMALL_SIZE, KERNEL_STACK_SMALL_COUNT)
+ALLOCATE_MEMPOOL(stack_pool_medium, KERNEL_STACK_MEDIUM_SIZE, KERNEL_STACK_MEDIUM_COUNT)
+ALLOCATE_MEMPOOL(stack_pool_large, KERNEL_STACK_LARGE_SIZE, KERNEL_STACK_LARGE_COUNT)
+struct MEMPOOL* stack_pools[] = { &stack_pool_small, &stack_pool_medium, &stack_pool_large };  // ordered by size
+#define STACK_POOLS_COUNT	(sizeof(stack_pools) / sizeof(stack_pools[0]))
+// This is the stack used for the kernel initialization and for the exception handlers (MSP)
+uint8_t __attribute__((aligned(4))) kernel_stack[KERNEL_STACK_SIZE];
+#define kernel_stack_top	(kernel_stack + sizeof(kernel_stack) - 1)
+static int32_t kernel_idle_task_func(void* arg);
+ALLOCATE_TASK(idle, 256, KERNEL_IDLE_TASK_PRIORITY, kernel_idle_task_func)  // This task runs when no other task is ready
 
 /* Exception return behavior */
 #define HANDLER_MSP	0xFFFFFFF1
@@ -24,115 +76,141 @@ extern uint32_t _modules_init_end;
 
 // Private functions
 static void kernel_add_task_to_list(struct TASK* input_task_ptr, struct TASK** task_list_ptr);
+static int32_t kernel_remove_task_from_list(struct TASK* task_ptr, struct TASK** task_list_ptr);
+static void kernel_add_task_to_ready_list(struct TASK* task_ptr);
+static void kernel_remove_task_from_ready_list(struct TASK* task_ptr);
+static void kernel_add_task_to_timer_queue(struct TASK* task_ptr, uint32_t ticks);
+static void kernel_remove_task_from_timer_queue(struct TASK* task_ptr);
 static struct TASK* kernel_get_next_task_to_run();
+static void kernel_check_for_context_switch();
 static void kernel_initialize_modules();
+static void kernel_set_task_dead(struct TASK* task_ptr, int32_t exit_code);
+static void kernel_process_pending_wakeups();
+static void kernel_handle_stack_overflow(struct TASK* task_ptr);
+static void kernel_paint_stack(uint32_t* stack_bottom, uint32_t stack_size);
+static uint32_t kernel_measure_stack_usage(uint32_t* stack_bottom, uint32_t stack_size);
 
 /********************************************************************/
 /*	KERNEL - CONTEXT SWITCH	*/
 /********************************************************************/
 #define set_pendsv()		SCB->ICSR |= SCB_ICSR_PENDSVSET_Msk
 
-uint8_t context_switch_direction; 
-	#define SWITCH_TO_TASK		0
-	#define SWITCH_TO_KERNEL	1
-	
-/*
- * Global interrupt control macros
- */
-#define kernel_disable_configurable_interrupts()		//__asm("cpsid i")
-#define kernel_enable_configurable_interrupts()			//__asm("cpsie i")
-#define kernel_disable_all_interrupts()					//__asm("cpsid f")
-#define kernel_enable_all_interrupts()					//__asm("cpsie f")
-
-/*
- * Activate the specified task from the kernel
- * This function is called by the kernel for activating a specific task
- */	
-static void kernel_activate_task(uint8_t* stack_ptr)
-{
-	active_task->status = TASK_STATE_RUNNING;
-	context_switch_direction = SWITCH_TO_TASK;
-	kernel_disable_configurable_interrupts();
-	set_pendsv();
-}
+// BASEPRI value which masks all the interrupts allowed to call kernel functions. The number
+// of priority bits is repeated here without the "U" suffix of the CMSIS definition, so that
+// the value can also be used as an immediate in the assembly code.
+#define KERNEL_NVIC_PRIO_BITS		4
+#if (KERNEL_NVIC_PRIO_BITS != __NVIC_PRIO_BITS)
+#error "KERNEL_NVIC_PRIO_BITS does not match the device's __NVIC_PRIO_BITS"
+#endif
+#define KERNEL_SYSCALL_BASEPRI		(KERNEL_MAX_SYSCALL_PRIORITY << (8 - KERNEL_NVIC_PRIO_BITS))
+#define _STRINGIFY(_x_)				#_x_
+#define STRINGIFY(_x_)				_STRINGIFY(_x_)
 
 /*
  * Put the current task to sleep
  * This function is called by generic functions in order to give the control
- * back to the kernel. The sleep can be limited in time or infinite, which means
+ * to the next ready task. The sleep can be limited in time or infinite, which means
  * that the task must be resumed by some other event.
  */
 void kernel_task_sleep(uint32_t sleep_ms)
 {
-	kernel_disable_configurable_interrupts();
+	uint32_t irq_state = kernel_enter_critical();
+	
+	kernel_remove_task_from_ready_list(active_task);
 	if (sleep_ms == SLEEP_FOREVER) {
 		active_task->status = TASK_STATE_WAITING_FOR_RESUME;
+	} else if (sleep_ms == 0) {
+		// just give the other ready tasks with the same priority a chance to run
+		kernel_add_task_to_ready_list(active_task);
 	} else {
-		active_task->resume_at_tickcount = systick_get_tick_count() + sleep_ms;
 		active_task->status = TASK_STATE_SLEEPING;
+		kernel_add_task_to_timer_queue(active_task, sleep_ms);
 	}
+	kernel_exit_critical(irq_state);
 	__asm("svc 1");
 }
 
 /*
- * This is the return point for all the tasks which terminate their own main function.
+ * This is the return point for all the tasks which terminate their own main function:
+ * the value returned by the function is still in r0, so it is the argument of this one.
  */
-__attribute__((interrupt)) void kernel_task_unexpected_death()
+void kernel_task_unexpected_death(int32_t exit_code)
 {
-	kernel_disable_configurable_interrupts();
-	active_task->status = TASK_STATE_DEAD;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	kernel_remove_task_from_ready_list(active_task);
+	kernel_set_task_dead(active_task, exit_code);
+	kernel_exit_critical(irq_state);
 	__asm("svc 2");
 }
 
 /*
  * PendSV handler
- * Load the new context from R0
+ * Save the context of the outgoing task, pick the next task to run and load its context.
+ * The switch goes straight from one task's PSP to the other one, so it costs a single
+ * exception entry/exit and a single register save/restore.
  *
  * NOTE: registers {r0,r1,r2,r3,r12,r14,r15,xPSR} are automatically saved by the hardware
- * 		when entering exceptions. As a consequence the first thing to do is to update the 
- *		stack pointer of the current task/kernel. Then the remaining registers must be 
+ * 		when entering exceptions. As a consequence the first thing to do is to get the 
+ *		stack pointer of the current task. Then the remaining registers must be 
  *		pushed onto the current stack, updating the stack pointer once again.
  *		Once context saving is completed, the new task can be loaded! The oppposite behavior
  *		is expected in this case: some registers are loaded manually from the stack, whereas
  *		the remaining ones are automatically loaded from the hardware.
+ *		On the very first switch there is no active task yet, so nothing is saved.
+ *		PendSV has the lowest priority, so BASEPRI is always 0 when it is entered: the
+ *		kernel lists are protected by raising it and it is cleared again on exit.
  */
 __attribute__((interrupt, naked)) void pendsv_handler(void)
 {
 	register uint32_t* _r0  __ASM("r0");
-	// get a copy of the current stack pointer in R0
-	if (context_switch_direction == SWITCH_TO_TASK) {
-		kernel.curr_stack_ptr = (uint8_t*)__get_MSP();
-		_r0 = (uint32_t*)kernel.curr_stack_ptr;
-		// save current task's registers - only the registers which were not automatically save by the 
-		// ARM core will be pushed here
-		__asm("stmdb r0!, {r4, r5, r6, r7, r8, r9, r10, r11, lr}");
-		kernel.curr_stack_ptr = (uint8_t*)_r0;
-		__set_MSP((uint32_t)_r0);
-		// get the new stack pointer in R0
-		_r0 = (uint32_t*)active_task->curr_stack_ptr;
-		// manually reload registers which are not automatically restored by the core on exception exit
-		__asm("ldmia r0!, {r4, r5, r6, r7, r8, r9, r10, r11, lr}");
-		// update the PSP stack pointer	
-		__set_PSP((uint32_t)_r0);
-		// exit the interrupt (all the other registers are automatically reloaded)
-		__asm("bx lr");
-	} else {
-		active_task->curr_stack_ptr = (uint8_t*)__get_PSP();
-		_r0 = (uint32_t*)active_task->curr_stack_ptr;
+	// mask the interrupts which may call kernel functions (only basic asm is allowed here)
+	__asm("mov r0, #" STRINGIFY(KERNEL_SYSCALL_BASEPRI));
+	__asm("msr basepri, r0");
+	if (active_task != NULL) {
+		// get a copy of the current stack pointer in R0
+		__asm("mrs r0, psp");
 		// save current task's registers - only the registers which were not automatically save by the 
 		// ARM core will be pushed here
 		__asm("stmdb r0!, {r4, r5, r6, r7, r8, r9, r10, r11, lr}");
 		active_task->curr_stack_ptr = (uint8_t*)_r0;
-		// get the new stack pointer in R0
-		_r0 = (uint32_t*)kernel.curr_stack_ptr;
-		// manually reload registers which are not automatically restored by the core on exception exit
-		__asm("ldmia r0!, {r4, r5, r6, r7, r8, r9, r10, r11, lr}");
-		// update the MSP stack pointer	
-		__set_MSP((uint32_t)_r0);
-		// exit the interrupt (all the other registers are automatically reloaded)
-		__asm("bx lr");
+		// a preempted task is still ready to run
+		if (active_task->status == TASK_STATE_RUNNING) {
+			active_task->status = TASK_STATE_READY;
+		}
+		if (active_task == &idle) {
+			idle_cycles += DWT->CYCCNT - idle_switch_in_cycles;
+		}
+#if KERNEL_CHECK_STACK_OVERFLOW
+		// the stack pointer went below the bottom of the stack or the guard word was overwritten
+		if ((active_task->curr_stack_ptr < task_stack_bottom(active_task)) || 
+			(*(uint32_t*)task_stack_bottom(active_task) != STACK_PATTERN)) {
+			kernel_handle_stack_overflow(active_task);
+		}
+#endif
+	}
+	// apply the wakeups requested by the interrupt handlers
+	if (pending_wakeups_read != pending_wakeups_write) {
+		kernel_process_pending_wakeups();
+	}
+	// select the new task (the idle task is always ready, so there's always one)
+	active_task = kernel_get_next_task_to_run();
+	active_task->status = TASK_STATE_RUNNING;
+	if (active_task == &idle) {
+		idle_switch_in_cycles = DWT->CYCCNT;
 	}
-	kernel_enable_configurable_interrupts();
+	active_task->time_slice_left = active_task->time_slice;
+	// get the new stack pointer in R0
+	_r0 = (uint32_t*)active_task->curr_stack_ptr;
+	// manually reload registers which are not automatically restored by the core on exception exit
+	__asm("ldmia r0!, {r4, r5, r6, r7, r8, r9, r10, r11, lr}");
+	// update the PSP stack pointer	
+	__asm("msr psp, r0");
+	// unmask the interrupts
+	__asm("mov r1, #0");
+	__asm("msr basepri, r1");
+	// exit the interrupt (all the other registers are automatically reloaded)
+	__asm("bx lr");
 }
 
 /*
@@ -151,13 +229,12 @@ __attribute__((interrupt)) void svc_handler()
 		case 1:  // Set current task to sleep		
 			break;
 		case 2:	// the active task reached the end of its main function
-			debug_msg("Task %s terminated\n", active_task->name);
+			debug_msg("Task %s terminated (exit code %d)\n", active_task->descriptor->name, active_task->exit_code);
 			break;
 		default:  // Unknown operation
 			break;
 	}
 	
-	context_switch_direction = SWITCH_TO_KERNEL;
 	set_pendsv();
 }
 
@@ -169,6 +246,7 @@ __attribute__((interrupt)) void svc_handler()
  */
 static void kernel_add_task_to_list(struct TASK* input_task_ptr, struct TASK** task_list_ptr)
 {
+	input_task_ptr->next_task = NULL;
 	// first task in the list
 	if (*task_list_ptr == NULL) {
 		*task_list_ptr = input_task_ptr;
@@ -194,8 +272,6 @@ static void kernel_add_task_to_list(struct TASK* input_task_ptr, struct TASK** t
 			input_task_ptr->next_task = curr_task_ptr;
 		}
 	}
-	input_task_ptr->id = tasks_count;
-	tasks_count ++;
 }
 
 /*
@@ -232,34 +308,352 @@ static int32_t kernel_remove_task_from_list(struct TASK* task_ptr, struct TASK**
 	return 0;
 }
 
+/*
+ * Append the task to the ready list of its priority level and mark that level
+ * as not empty in the bitmap
+ */
+static void kernel_add_task_to_ready_list(struct TASK* task_ptr)
+{
+	uint8_t priority = task_ptr->priority;
+	
+	task_ptr->next_task = NULL;
+	task_ptr->status = TASK_STATE_READY;
+	if (ready_tasks_lists[priority] == NULL) {
+		ready_tasks_lists[priority] = task_ptr;
+	} else {
+		ready_tasks_lists_tail[priority]->next_task = task_ptr;
+	}
+	ready_tasks_lists_tail[priority] = task_ptr;
+	ready_priorities_bitmap |= PRIORITY_BIT(priority);
+}
+
+/*
+ * Remove the task from the ready list of its priority level. The running task is
+ * always the first one of its list, so in this case the removal is immediate.
+ */
+static void kernel_remove_task_from_ready_list(struct TASK* task_ptr)
+{
+	uint8_t priority = task_ptr->priority;
+	struct TASK* prev_ptr = NULL;
+	struct TASK* curr_ptr = ready_tasks_lists[priority];
+	
+	while ((curr_ptr != NULL) && (curr_ptr != task_ptr)) {
+		prev_ptr = curr_ptr;
+		curr_ptr = curr_ptr->next_task;
+	}
+	// The task is not ready
+	if (curr_ptr == NULL) {
+		return;
+	}
+	
+	if (prev_ptr == NULL) {
+		ready_tasks_lists[priority] = curr_ptr->next_task;
+	} else {
+		prev_ptr->next_task = curr_ptr->next_task;
+	}
+	if (ready_tasks_lists_tail[priority] == curr_ptr) {
+		ready_tasks_lists_tail[priority] = prev_ptr;
+	}
+	if (ready_tasks_lists[priority] == NULL) {
+		ready_priorities_bitmap &= ~PRIORITY_BIT(priority);
+	}
+	curr_ptr->next_task = NULL;
+}
+
+/*
+ * Remove the task from the list it currently belongs to (based on its status)
+ */
+static void kernel_detach_task(struct TASK* task_ptr)
+{
+	switch (task_ptr->status) {
+		case TASK_STATE_RUNNING:
+		case TASK_STATE_READY:
+			kernel_remove_task_from_ready_list(task_ptr);
+			break;
+		case TASK_STATE_SLEEPING:
+			kernel_remove_task_from_timer_queue(task_ptr);
+			break;
+		case TASK_STATE_DEAD:
+			kernel_remove_task_from_list(task_ptr, &dead_tasks_list);
+			break;
+		case TASK_STATE_WAITING_FOR_OBJECT:
+			kernel_remove_task_from_list(task_ptr, task_ptr->wait_list);
+			task_ptr->wait_list = NULL;
+			kernel_remove_task_from_timer_queue(task_ptr);
+			kernel_mutex_cancel_wait(task_ptr);
+			break;
+		case TASK_STATE_WAITING_FOR_RESUME:
+			// tasks waiting for a notification with a timeout are in the timer queue
+			kernel_remove_task_from_timer_queue(task_ptr);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Insert the task in the timer queue so that it expires after the specified amount of ticks.
+ * The queue is delta-sorted: each task stores the number of ticks between its expiration
+ * and the one of the previous task, so the tick handler only needs to look at the head.
+ * Tasks expiring at the same tick are kept in FIFO order.
+ */
+static void kernel_add_task_to_timer_queue(struct TASK* task_ptr, uint32_t ticks)
+{
+	struct TASK* curr_ptr = timer_queue;
+	struct TASK* prev_ptr = NULL;
+	
+	while ((curr_ptr != NULL) && (ticks >= curr_ptr->timer_delta)) {
+		ticks -= curr_ptr->timer_delta;
+		prev_ptr = curr_ptr;
+		curr_ptr = curr_ptr->next_timer;
+	}
+	
+	task_ptr->timer_delta = ticks;
+	task_ptr->next_timer = curr_ptr;
+	if (curr_ptr != NULL) {
+		curr_ptr->timer_delta -= ticks;
+	}
+	if (prev_ptr == NULL) {
+		timer_queue = task_ptr;
+	} else {
+		prev_ptr->next_timer = task_ptr;
+	}
+}
+
+/*
+ * Remove the task from the timer queue before its expiration. The remaining delay
+ * is given back to the following task so that its expiration time does not change.
+ */
+static void kernel_remove_task_from_timer_queue(struct TASK* task_ptr)
+{
+	struct TASK* curr_ptr = timer_queue;
+	struct TASK* prev_ptr = NULL;
+	
+	while ((curr_ptr != NULL) && (curr_ptr != task_ptr)) {
+		prev_ptr = curr_ptr;
+		curr_ptr = curr_ptr->next_timer;
+	}
+	// The task is not in the queue
+	if (curr_ptr == NULL) {
+		return;
+	}
+	
+	if (curr_ptr->next_timer != NULL) {
+		curr_ptr->next_timer->timer_delta += curr_ptr->timer_delta;
+	}
+	if (prev_ptr == NULL) {
+		timer_queue = curr_ptr->next_timer;
+	} else {
+		prev_ptr->next_timer = curr_ptr->next_timer;
+	}
+	curr_ptr->next_timer = NULL;
+}
+
 /*
  * Returns a pointer to the next active task which should be set on execution.
  * A NULL value is returned if there's no ready task to run.
+ * The highest priority with a non-empty ready list is given by the number of leading
+ * zeros in the bitmap, so this takes constant time whatever the number of tasks.
  */
 static struct TASK* kernel_get_next_task_to_run()
 {
-	uint32_t current_tick_count = systick_get_tick_count();
-	struct TASK* curr_task_ptr = active_tasks_list;
+	if (ready_priorities_bitmap == 0) {
+		return NULL;
+	}
+	return ready_tasks_lists[__CLZ(ready_priorities_bitmap)];
+}
+
+/*
+ * Ask for a context switch (preemption) if a task with higher priority than the active
+ * one is ready. This must be called every time a task becomes ready.
+ */
+static void kernel_check_for_context_switch()
+{
+	if ((active_task != NULL) && (__CLZ(ready_priorities_bitmap) < active_task->priority)) {
+		set_pendsv();
+	}
+}
+
+/*
+ * Move the running task at the end of its ready list once its quantum expired, so that
+ * the other ready tasks with the same priority get their share of CPU time
+ */
+static void kernel_update_time_slice()
+{
+	uint8_t priority;
 	
-	while (curr_task_ptr != NULL) {
-		if (curr_task_ptr->status == TASK_STATE_SLEEPING) {
-			if (current_tick_count >= curr_task_ptr->resume_at_tickcount)
-				return curr_task_ptr;
-		} 
-		curr_task_ptr = curr_task_ptr->next_task;
+	if ((active_task == NULL) || (active_task->status != TASK_STATE_RUNNING) || (active_task->time_slice == 0)) {
+		return;
+	}
+	if (active_task->time_slice_left > 1) {
+		active_task->time_slice_left--;
+		return;
+	}
+	active_task->time_slice_left = active_task->time_slice;
+	// the running task is the first one of its list: rotate only if some other task is ready
+	priority = active_task->priority;
+	if (active_task->next_task != NULL) {
+		ready_tasks_lists[priority] = active_task->next_task;
+		ready_tasks_lists_tail[priority]->next_task = active_task;
+		ready_tasks_lists_tail[priority] = active_task;
+		active_task->next_task = NULL;
+		set_pendsv();
 	}
-	return NULL;
 }
 
 /*
- * This simply kills a task
+ * Apply all the wakeups recorded by the _from_isr functions. This is called by the PendSV
+ * handler, which has the lowest priority, so the interrupt handlers which reserved a slot
+ * have normally filled it already, and with BASEPRI raised no new slot can be reserved.
+ * Processing stops anyway at the first slot which is not filled yet: its handler pends
+ * PendSV again once it is done. The next task is going to be selected right after this, 
+ * so the PendSV requests made by the wakeups are dropped.
  */
-void kernel_task_kill(struct TASK* task_ptr)
+static void kernel_process_pending_wakeups()
 {
+	struct PENDING_WAKEUP* wakeup_ptr;
+	
+	while (pending_wakeups_read != pending_wakeups_write) {
+		wakeup_ptr = &pending_wakeups[pending_wakeups_read & (KERNEL_PENDING_WAKEUPS - 1)];
+		if (!wakeup_ptr->valid) {
+			break;
+		}
+		if (wakeup_ptr->task == NULL) {
+			// the task was deleted after the request was recorded
+		} else if (wakeup_ptr->type == PENDING_WAKEUP_ACTIVATE) {
+			kernel_activate_task_immediately(wakeup_ptr->task);
+		} else {
+			kernel_notify(wakeup_ptr->task, wakeup_ptr->value, wakeup_ptr->type);
+		}
+		wakeup_ptr->valid = FALSE;
+		pending_wakeups_read++;
+	}
+	SCB->ICSR = SCB_ICSR_PENDSVCLR_Msk;
+}
+
+/*
+ * Record a wakeup request in the pending buffer and pend PendSV. Nested interrupt handlers
+ * reserve their slot with an exclusive access, so no critical section is needed, and the
+ * slot is marked as valid only once it has been filled.
+ * Returns FALSE if the buffer is full.
+ */
+static uint8_t kernel_add_pending_wakeup(struct TASK* task_ptr, uint32_t value, uint8_t type)
+{
+	struct PENDING_WAKEUP* wakeup_ptr;
+	uint32_t write_index;
+	
+	do {
+		write_index = __LDREXW(&pending_wakeups_write);
+		if ((write_index - pending_wakeups_read) >= KERNEL_PENDING_WAKEUPS) {
+			__CLREX();
+			return FALSE;
+		}
+	} while (__STREXW(write_index + 1, &pending_wakeups_write) != 0);
+	
+	wakeup_ptr = &pending_wakeups[write_index & (KERNEL_PENDING_WAKEUPS - 1)];
+	wakeup_ptr->task = task_ptr;
+	wakeup_ptr->value = value;
+	wakeup_ptr->type = type;
+	__DMB();
+	wakeup_ptr->valid = TRUE;
+	set_pendsv();
+	return TRUE;
+}
+
+/*
+ * Move a task, already removed from its list, to the dead list and give its exit code 
+ * to all the tasks which are joining it. The mutexes it owns are handed over to their
+ * waiters (or unlocked) and it gets back its own priority.
+ */
+static void kernel_set_task_dead(struct TASK* task_ptr, int32_t exit_code)
+{
+	struct TASK* joining_task;
+	
+	kernel_mutex_release_task(task_ptr);
+	task_ptr->priority = task_ptr->base_priority;
 	task_ptr->status = TASK_STATE_DEAD;
-	if (kernel_remove_task_from_list(task_ptr, &active_tasks_list) >= 0) {
-		kernel_add_task_to_list(task_ptr, &dead_tasks_list);
+	task_ptr->exit_code = exit_code;
+	kernel_add_task_to_list(task_ptr, &dead_tasks_list);
+	while ((joining_task = task_ptr->joining_tasks_list) != NULL) {
+		*(int32_t*)joining_task->wait_data = exit_code;
+		kernel_wake_up_task(joining_task, KERNEL_OK);
+	}
+}
+
+/*
+ * Called by the PendSV handler when the outgoing task overflowed its stack: the task is 
+ * killed (exit code KERNEL_ERROR) or, if the hook asks for it, restarted with a clean stack.
+ * The idle task is always restarted, since the scheduler can't run without it.
+ * NOTE: the memory below the stack may already be corrupted, this only stops the damage.
+ */
+static void kernel_handle_stack_overflow(struct TASK* task_ptr)
+{
+	uint8_t action = STACK_OVERFLOW_KILL;
+	
+	debug_msg("Task %s overflowed its stack\n", task_ptr->descriptor->name);
+	if (stack_overflow_hook != NULL) {
+		action = stack_overflow_hook(task_ptr);
+	}
+	if (task_ptr == &idle) {
+		action = STACK_OVERFLOW_RESTART;
+	}
+	kernel_detach_task(task_ptr);
+	kernel_set_task_dead(task_ptr, KERNEL_ERROR);
+	if (action == STACK_OVERFLOW_RESTART) {
+		kernel_fill_stack_with_pattern(task_ptr);
+		kernel_activate_task_immediately(task_ptr);
+	}
+}
+
+/*
+ * This simply kills a task. Its exit code is KERNEL_ERROR.
+ */
+void kernel_task_kill(struct TASK* task_ptr)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (task_ptr->status != TASK_STATE_DEAD) {
+		kernel_detach_task(task_ptr);
+		kernel_set_task_dead(task_ptr, KERNEL_ERROR);
+		// a task which kills itself must release the CPU immediately
+		if (task_ptr == active_task) {
+			set_pendsv();
+		}
+	}
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Wait for at most timeout ticks until the selected task terminates (either returning from
+ * its function or being killed) and get its exit code. If the task is already dead the
+ * exit code of its last run is returned at once.
+ * Returns KERNEL_OK, KERNEL_TIMEOUT or KERNEL_ERROR (a task cannot join itself).
+ */
+int32_t kernel_task_join(struct TASK* task_ptr, uint32_t timeout, int32_t* exit_code)
+{
+	int32_t code;
+	int32_t ret;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (task_ptr == active_task) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_ERROR;
+	}
+	if (task_ptr->status == TASK_STATE_DEAD) {
+		code = task_ptr->exit_code;
+		kernel_exit_critical(irq_state);
+		ret = KERNEL_OK;
+	} else {
+		// the exit code is written straight here by kernel_set_task_dead()
+		if ((timeout != NO_WAIT) && !kernel_is_in_interrupt()) {
+			active_task->wait_data = &code;
+		}
+		ret = kernel_wait_on_list(&task_ptr->joining_tasks_list, timeout, irq_state);
+	}
+	if ((ret == KERNEL_OK) && (exit_code != NULL)) {
+		*exit_code = code;
 	}
+	return ret;
 }
 
 /*
@@ -281,77 +675,140 @@ static void kernel_initialize_modules()
  */
 static void kernel_prepare_task_stack(struct TASK* task_ptr)
 {
-	struct CONTEXT* context_ptr = (struct CONTEXT*)(task_ptr->total_stack_ptr - (uint8_t*)sizeof(struct CONTEXT) + 1);
+	struct CONTEXT* context_ptr = (struct CONTEXT*)(task_ptr->descriptor->stack_top - (uint8_t*)sizeof(struct CONTEXT) + 1);
 	context_ptr->lr = (uint32_t) THREAD_PSP;
 	context_ptr->exc.lr = (uint32_t) kernel_task_unexpected_death;
-	context_ptr->exc.pc = (uint32_t) task_ptr->func;
+	context_ptr->exc.pc = (uint32_t) task_ptr->descriptor->func;
 	context_ptr->exc.xpsr = (uint32_t) 0x01000000; /* PSR Thumb bit */
 	// Set the task's structure properties
 	task_ptr->curr_stack_ptr = (uint8_t*)context_ptr;
 }
 
 /*
- * Fill the specified task's stack with a pattern byte
+ * Sample the DWT cycle counter and extend it to 64 bits. The counter wraps around every
+ * ~59 s at 72 MHz, so sampling it at every tick (or after every tickless idle period, 
+ * which is much shorter) never misses a wrap.
  */
-#define STACK_PATTERN 		0xAA
-static void kernel_fill_stack_with_pattern(struct TASK* task)
+static void kernel_update_cycle_count()
 {
-	uint8_t* stack_start = task->total_stack_ptr;
-	uint8_t* stack_end = task->total_stack_ptr - task->stack_size + 1;
+	// kernel_get_cycles() must never see cycle_count_high and last_cycle_count out of step
+	uint32_t irq_state = kernel_enter_critical();
+	uint32_t cycle_count = DWT->CYCCNT;
 	
-	uint8_t* ptr = stack_start;
-	
-	while(ptr >= stack_end) {
-		*ptr = STACK_PATTERN;
-		ptr--;
+	if (cycle_count < last_cycle_count) {
+		cycle_count_high++;
 	}
+	last_cycle_count = cycle_count;
+	kernel_exit_critical(irq_state);
 }
 
 /*
- * Go through the task's stack and check how many pattern bytes 
- * are still unchanged
+ * Close the current CPU load sample once a second is elapsed. The load is the fraction of 
+ * the period which was not spent in the idle task. Since the cycle counter is stopped
+ * while the core sleeps, the busy cycles are the counted ones minus the idle task's ones,
+ * whereas the length of the period is derived from the elapsed ticks. The idle task never
+ * sleeps past the end of the current sample, so every sample covers exactly one second.
  */
-__attribute__((unused)) static uint32_t kernel_get_stack_usage(struct TASK* task)
+static void kernel_update_cpu_load(uint32_t elapsed_ticks)
 {
-	uint8_t* stack_start = task->total_stack_ptr;
-	uint8_t* stack_end = task->total_stack_ptr - task->stack_size + 1;
+	uint32_t now, busy_cycles, load;
 	
-	uint8_t* ptr = stack_end;
+	load_sample_ticks += elapsed_ticks;
+	if (load_sample_ticks < TICK_RATE_HZ) {
+		return;
+	}
 	
-	while ((ptr <= stack_start) && (*ptr == STACK_PATTERN)) {
-		ptr++;
+	now = DWT->CYCCNT;
+	if (active_task == &idle) {
+		idle_cycles += now - idle_switch_in_cycles;
+		idle_switch_in_cycles = now;
 	}
-	return (uint32_t)(stack_start - ptr);
+	busy_cycles = now - load_sample_start_cycles;
+	busy_cycles = (busy_cycles > idle_cycles) ? (busy_cycles - idle_cycles) : 0;
+	load = busy_cycles / ((cycles_per_tick * load_sample_ticks) / 1000);
+	
+	cpu_load_history[cpu_load_history_index] = (load > 1000) ? 1000 : load;
+	cpu_load_history_index = (cpu_load_history_index + 1) % KERNEL_CPU_LOAD_HISTORY;
+	if (cpu_load_history_count < KERNEL_CPU_LOAD_HISTORY) {
+		cpu_load_history_count++;
+	}
+	
+	idle_cycles = 0;
+	load_sample_start_cycles = now;
+	load_sample_ticks = 0;
 }
 
 /*
- * This is the first kernel function called after reset and it includes the scheduler.
+ * Idle task: it runs only when no other task is ready, calls the user's idle hook (if 
+ * any) and puts the core to sleep until the next interrupt. With tickless idle the tick
+ * interrupt is also stopped until the first task in the timer queue has to wake up.
+ * Interrupts are disabled (PRIMASK) while deciding how long to sleep: a pending 
+ * interrupt still wakes the core up from WFI, but its handler runs only after the
+ * tick count has been corrected. BASEPRI cannot be used here because masked interrupts
+ * do not wake the core up from WFI.
+ */
+static int32_t kernel_idle_task_func(void* arg)
+{
+	uint32_t idle_ticks;
+	
+	while (1) {
+		if (idle_hook != NULL) {
+			idle_hook();
+		}
+		__disable_irq();
+		// Sleep only if no task became ready in the meanwhile
+		if (ready_priorities_bitmap == PRIORITY_BIT(KERNEL_IDLE_TASK_PRIORITY)) {
+			idle_ticks = (timer_queue != NULL) ? timer_queue->timer_delta : SLEEP_FOREVER;
+			// wake up at the end of the CPU load sample at the latest
+			if (idle_ticks > (TICK_RATE_HZ - load_sample_ticks)) {
+				idle_ticks = TICK_RATE_HZ - load_sample_ticks;
+			}
+			if (KERNEL_USE_TICKLESS_IDLE && (idle_ticks >= KERNEL_TICKLESS_IDLE_MIN_TICKS)) {
+				kernel_process_ticks(systick_sleep(idle_ticks));
+			} else {
+				__DSB();
+				__WFI();
+			}
+		}
+		__enable_irq();
+	}
+	return KERNEL_OK;
+}
+
+/*
+ * This is the first kernel function called after reset: it initializes the system and
+ * starts the first task. From then on scheduling is done in the PendSV handler.
  * The function is "naked" because we don't need any prologue/epilogue as we're never 
- * supposed to exit from this looping function.
+ * supposed to exit from it.
  */
 __attribute__((naked)) void kernel_main(void)
 { 
 	// initialize all the modules
 	kernel_initialize_modules();
 	// fill the kernel stack with the predefined pattern
-	kernel_fill_stack_with_pattern(&kernel);
+	kernel_paint_stack((uint32_t*)kernel_stack, sizeof(kernel_stack));
 	// set the MSP to the beginning of the kernel's stack
-	__set_MSP((uint32_t)kernel.total_stack_ptr);
+	__set_MSP((uint32_t)kernel_stack_top);
+	// The idle task is always ready to run
+	kernel_fill_stack_with_pattern(&idle);
+	kernel_prepare_task_stack(&idle);
+	kernel_add_task_to_ready_list(&idle);
+	idle.next_initialized_task = initialized_tasks_list;
+	initialized_tasks_list = &idle;
+	// Enable the DWT cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	cycles_per_tick = clock_get_HCLK_freq() / TICK_RATE_HZ;
 	// Configure PendSV priority
 	NVIC_SetPriority(PendSV_IRQn, (1UL << __NVIC_PRIO_BITS) - 1UL);
 	// Configure SysTick
 	systick_init();
 	debug_msg("Initialization completed. Launching scheduler\n");
-	// Scheduler loop
-	while (1) {
-		active_task = kernel_get_next_task_to_run();
-		if (active_task != NULL) {
-			kernel_activate_task(active_task->curr_stack_ptr);
-			// Execution will return here once the task has released the control
-			// debug_msg("Task %s - stack usage %d/%d\n", active_task->name, kernel_get_stack_usage(active_task), active_task->stack_size);
-			active_task = NULL;
-		}
-	}
+	// Switch to the first task. Execution never gets back here.
+	active_task = NULL;
+	set_pendsv();
+	while (1);
 }
 
 /********************************************************************/
@@ -362,9 +819,126 @@ __attribute__((naked)) void kernel_main(void)
  */
 void kernel_init_task(struct TASK* task_ptr)
 {
-	kernel_fill_stack_with_pattern(task_ptr);	// for debug purposes
+	uint32_t irq_state;
+	
+	if (task_ptr->base_priority >= KERNEL_IDLE_TASK_PRIORITY) {
+		task_ptr->base_priority = KERNEL_IDLE_TASK_PRIORITY - 1;
+	}
+	task_ptr->priority = task_ptr->base_priority;
+	kernel_fill_stack_with_pattern(task_ptr);	// for stack usage measurement
 	kernel_prepare_task_stack(task_ptr);
+	// tasks can also be created while the scheduler is running
+	irq_state = kernel_enter_critical();
+	task_ptr->id = tasks_count;
+	tasks_count ++;
+	task_ptr->next_initialized_task = initialized_tasks_list;
+	initialized_tasks_list = task_ptr;
 	kernel_add_task_to_list(task_ptr, &dead_tasks_list);
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Create a task at runtime: the control block is taken from the task pool and the stack
+ * from the smallest stack size class which fits stack_size (the task gets the whole block).
+ * The task is initialized but not started: use the kernel_activate_task_*() functions.
+ * Returns NULL if the pools are exhausted or no size class is large enough.
+ */
+struct TASK* kernel_task_create(const char* name, int32_t (*func)(void* arg), uint32_t stack_size, uint8_t priority)
+{
+	struct DYNAMIC_TASK* dynamic_task;
+	struct TASK* task_ptr;
+	struct MEMPOOL* stack_pool = NULL;
+	uint8_t* stack;
+	uint8_t i;
+	
+	for (i = 0; i < STACK_POOLS_COUNT; i++) {
+		if (stack_pools[i]->block_size >= stack_size) {
+			stack_pool = stack_pools[i];
+			break;
+		}
+	}
+	if (stack_pool == NULL) {
+		return NULL;
+	}
+	dynamic_task = (struct DYNAMIC_TASK*)kernel_mempool_alloc(&task_pool);
+	if (dynamic_task == NULL) {
+		return NULL;
+	}
+	stack = (uint8_t*)kernel_mempool_alloc(stack_pool);
+	if (stack == NULL) {
+		kernel_mempool_free(&task_pool, dynamic_task);
+		return NULL;
+	}
+	
+	dynamic_task->descriptor.name = name;
+	dynamic_task->descriptor.func = func;
+	dynamic_task->descriptor.stack_top = stack + stack_pool->block_size - 1;
+	dynamic_task->descriptor.stack_size = stack_pool->block_size;
+	task_ptr = &dynamic_task->task;
+	*task_ptr = (struct TASK)KERNEL_TASK_INITIALIZER(&dynamic_task->descriptor, dynamic_task->descriptor.stack_top, priority);
+	kernel_init_task(task_ptr);
+	return task_ptr;
+}
+
+/*
+ * Delete a task created with kernel_task_create(): it is killed (if still alive), removed
+ * from the list of the initialized tasks and its control block and stack are given back
+ * to the pools. The tasks joining it get KERNEL_ERROR as exit code and the mutexes it
+ * owns are handed over to their waiters. Everything up to the release of the memory is
+ * done in a single critical section, so nobody can activate the task in the meanwhile.
+ * Returns KERNEL_ERROR for static tasks and for the active task (a task which wants to
+ * terminate must return from its function and be deleted by another one).
+ */
+int32_t kernel_task_delete(struct TASK* task_ptr)
+{
+	struct TASK** task_list_ptr;
+	uint32_t irq_state;
+	uint32_t index;
+	uint8_t i;
+	
+	if (((uint8_t*)task_ptr < task_pool.buffer) || 
+		((uint8_t*)task_ptr >= task_pool.buffer + (task_pool.block_count * task_pool.block_size))) {
+		return KERNEL_ERROR;
+	}
+	
+	irq_state = kernel_enter_critical();
+	if (task_ptr == active_task) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_ERROR;
+	}
+	if (task_ptr->status != TASK_STATE_DEAD) {
+		kernel_detach_task(task_ptr);
+		kernel_set_task_dead(task_ptr, KERNEL_ERROR);
+	}
+	// a task which is not in the dead list is not a valid one (e.g. it was already deleted)
+	if (kernel_remove_task_from_list(task_ptr, &dead_tasks_list) != 0) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_ERROR;
+	}
+	// drop the wakeups requested by interrupt handlers which are not processed yet
+	for (index = pending_wakeups_read; index != pending_wakeups_write; index++) {
+		if (pending_wakeups[index & (KERNEL_PENDING_WAKEUPS - 1)].task == task_ptr) {
+			pending_wakeups[index & (KERNEL_PENDING_WAKEUPS - 1)].task = NULL;
+		}
+	}
+	task_list_ptr = &initialized_tasks_list;
+	while (*task_list_ptr != NULL) {
+		if (*task_list_ptr == task_ptr) {
+			*task_list_ptr = task_ptr->next_initialized_task;
+			break;
+		}
+		task_list_ptr = &(*task_list_ptr)->next_initialized_task;
+	}
+	kernel_exit_critical(irq_state);
+	
+	for (i = 0; i < STACK_POOLS_COUNT; i++) {
+		if (stack_pools[i]->block_size == task_ptr->descriptor->stack_size) {
+			kernel_mempool_free(stack_pools[i], task_stack_bottom(task_ptr));
+			break;
+		}
+	}
+	kernel_mempool_free(&task_pool, task_ptr);
+	return KERNEL_OK;
 }
 
 /*
@@ -372,15 +946,26 @@ void kernel_init_task(struct TASK* task_ptr)
  */
 void kernel_activate_task_after_ms(struct TASK* task_ptr, uint32_t delay)
 {
+	uint32_t irq_state;
+	
 	if (task_ptr != NULL) {
-		if (task_ptr->status == TASK_STATE_DEAD) {
-			kernel_prepare_task_stack(task_ptr);
-		}
-		task_ptr->status = TASK_STATE_SLEEPING;
-		task_ptr->resume_at_tickcount = systick_get_tick_count() + delay;
-		if (kernel_remove_task_from_list(task_ptr, &dead_tasks_list) >= 0) {
-			kernel_add_task_to_list(task_ptr, &active_tasks_list);
+		irq_state = kernel_enter_critical();
+		// Tasks which are already ready to run are left untouched
+		if ((task_ptr->status != TASK_STATE_READY) && (task_ptr->status != TASK_STATE_RUNNING)) {
+			if (task_ptr->status == TASK_STATE_DEAD) {
+				task_ptr->priority = task_ptr->base_priority;
+				kernel_prepare_task_stack(task_ptr);
+			}
+			kernel_detach_task(task_ptr);
+			if (delay == 0) {
+				kernel_add_task_to_ready_list(task_ptr);
+			} else {
+				task_ptr->status = TASK_STATE_SLEEPING;
+				kernel_add_task_to_timer_queue(task_ptr, delay);
+			}
+			kernel_check_for_context_switch();
 		}
+		kernel_exit_critical(irq_state);
 	}
 }
 
@@ -392,6 +977,158 @@ void kernel_activate_task_immediately(struct TASK* task_ptr)
 	kernel_activate_task_after_ms(task_ptr, 0UL);
 }
 
+/*
+ * Called by the SysTick handler at every tick (or after a tickless idle period with the
+ * number of ticks elapsed while sleeping): the head of the timer queue is advanced and 
+ * all the tasks whose timeout expired are moved to the ready lists. Each expiration
+ * costs O(1), whatever the number of sleeping tasks. Then the time slice of the running
+ * task is updated.
+ */
+void kernel_process_ticks(uint32_t elapsed_ticks)
+{
+	struct TASK* task_ptr;
+	uint32_t irq_state;
+	uint32_t remaining_ticks = elapsed_ticks;
+	
+	kernel_update_cycle_count();
+	if (elapsed_ticks == 0) {
+		return;
+	}
+	irq_state = kernel_enter_critical();
+	if (timer_queue != NULL) {
+		while ((timer_queue != NULL) && (timer_queue->timer_delta <= remaining_ticks)) {
+			remaining_ticks -= timer_queue->timer_delta;
+			task_ptr = timer_queue;
+			timer_queue = task_ptr->next_timer;
+			task_ptr->next_timer = NULL;
+			// a task waiting for an object with a timeout: the wait failed
+			if (task_ptr->status == TASK_STATE_WAITING_FOR_OBJECT) {
+				kernel_remove_task_from_list(task_ptr, task_ptr->wait_list);
+				task_ptr->wait_list = NULL;
+				task_ptr->wait_result = KERNEL_TIMEOUT;
+				kernel_mutex_cancel_wait(task_ptr);
+			}
+			kernel_add_task_to_ready_list(task_ptr);
+		}
+		if (timer_queue != NULL) {
+			timer_queue->timer_delta -= remaining_ticks;
+		}
+		kernel_check_for_context_switch();
+	}
+	kernel_update_time_slice();
+	kernel_update_cpu_load(elapsed_ticks);
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Set the round-robin quantum (in ticks) of the selected task. 0 disables time slicing.
+ */
+void kernel_set_task_time_slice(struct TASK* task_ptr, uint16_t ticks)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	task_ptr->time_slice = ticks;
+	task_ptr->time_slice_left = ticks;
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Send a notification to the selected task: the value is written (NOTIFY_SET), incremented
+ * (NOTIFY_INCREMENT) or ORed (NOTIFY_OR) into the task's notification value. If the task is
+ * waiting for resume (either in kernel_notify_wait() or sleeping with SLEEP_FOREVER) it is
+ * made ready, preempting the active task if needed. 
+ * No object is involved, so this is the fastest way to signal a task from an interrupt handler.
+ */
+void kernel_notify(struct TASK* task_ptr, uint32_t value, uint8_t mode)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	switch (mode) {
+		case NOTIFY_INCREMENT:
+			task_ptr->notify_value++;
+			break;
+		case NOTIFY_OR:
+			task_ptr->notify_value |= value;
+			break;
+		default:
+			task_ptr->notify_value = value;
+			break;
+	}
+	task_ptr->notify_pending = TRUE;
+	if (task_ptr->status == TASK_STATE_WAITING_FOR_RESUME) {
+		kernel_remove_task_from_timer_queue(task_ptr);
+		kernel_add_task_to_ready_list(task_ptr);
+		kernel_check_for_context_switch();
+	}
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Wait until the active task is notified, for at most timeout ticks. The notification
+ * value is returned in value (if not NULL) and then the bits in clear_mask are cleared
+ * (e.g. 0xFFFFFFFF resets the value, so that NOTIFY_INCREMENT gives counting semantics).
+ * Returns KERNEL_OK or KERNEL_TIMEOUT. From interrupt handlers it never blocks.
+ */
+int32_t kernel_notify_wait(uint32_t clear_mask, uint32_t* value, uint32_t timeout)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (!active_task->notify_pending) {
+		if ((timeout == NO_WAIT) || kernel_is_in_interrupt()) {
+			kernel_exit_critical(irq_state);
+			return KERNEL_TIMEOUT;
+		}
+		kernel_remove_task_from_ready_list(active_task);
+		active_task->status = TASK_STATE_WAITING_FOR_RESUME;
+		if (timeout != WAIT_FOREVER) {
+			kernel_add_task_to_timer_queue(active_task, timeout);
+		}
+		kernel_exit_critical(irq_state);
+		__asm("svc 1");
+		// Execution gets back here once the task has been notified, the timeout expired
+		// or the task was resumed by kernel_activate_task_immediately()
+		irq_state = kernel_enter_critical();
+		if (!active_task->notify_pending) {
+			kernel_exit_critical(irq_state);
+			return KERNEL_TIMEOUT;
+		}
+	}
+	
+	if (value != NULL) {
+		*value = active_task->notify_value;
+	}
+	active_task->notify_value &= ~clear_mask;
+	active_task->notify_pending = FALSE;
+	kernel_exit_critical(irq_state);
+	return KERNEL_OK;
+}
+
+/*
+ * Interrupt handler version of kernel_activate_task_immediately(): the request is only
+ * recorded and the ready lists are updated by the PendSV handler on interrupt exit, so 
+ * the handler stays short and the task still runs as soon as all the interrupts are served.
+ * If the pending buffer is full, or if this is called by a task (PendSV could then run 
+ * before the request is completely recorded), the task is activated at once.
+ */
+void kernel_activate_task_from_isr(struct TASK* task_ptr)
+{
+	if (!kernel_is_in_interrupt() || !kernel_add_pending_wakeup(task_ptr, 0, PENDING_WAKEUP_ACTIVATE)) {
+		kernel_activate_task_immediately(task_ptr);
+	}
+}
+
+/*
+ * Interrupt handler version of kernel_notify(): the notification is delivered by the
+ * PendSV handler on interrupt exit. If the pending buffer is full, or if this is called
+ * by a task, it is delivered at once.
+ */
+void kernel_notify_from_isr(struct TASK* task_ptr, uint32_t value, uint8_t mode)
+{
+	if (!kernel_is_in_interrupt() || !kernel_add_pending_wakeup(task_ptr, value, mode)) {
+		kernel_notify(task_ptr, value, mode);
+	}
+}
+
 /*
  * Return the status of the selected task
  */
@@ -399,3 +1136,322 @@ uint8_t kernel_get_task_status(struct TASK* task_ptr)
 {
 	return task_ptr->status;
 }
+
+/*
+ * Iterate over all the initialized tasks (including the kernel's idle task): pass NULL
+ * to get the first one. NULL is returned after the last one.
+ */
+struct TASK* kernel_get_next_initialized_task(struct TASK* task_ptr)
+{
+	return (task_ptr == NULL) ? initialized_tasks_list : task_ptr->next_initialized_task;
+}
+
+/*
+ * Fill a stack with the pattern word. The stack is written one word at a time, 
+ * four words per iteration.
+ */
+static void kernel_paint_stack(uint32_t* stack_bottom, uint32_t stack_size)
+{
+	uint32_t* ptr = stack_bottom;
+	uint32_t words = stack_size / sizeof(uint32_t);
+	
+	while (words >= 4) {
+		ptr[0] = STACK_PATTERN;
+		ptr[1] = STACK_PATTERN;
+		ptr[2] = STACK_PATTERN;
+		ptr[3] = STACK_PATTERN;
+		ptr += 4;
+		words -= 4;
+	}
+	while (words > 0) {
+		*ptr++ = STACK_PATTERN;
+		words--;
+	}
+}
+
+/*
+ * Go through a stack from the bottom and check how many pattern words are still
+ * unchanged. Returns the maximum stack usage (high-water mark) in bytes.
+ */
+static uint32_t kernel_measure_stack_usage(uint32_t* stack_bottom, uint32_t stack_size)
+{
+	uint32_t words = stack_size / sizeof(uint32_t);
+	uint32_t i = 0;
+	
+	while ((i < words) && (stack_bottom[i] == STACK_PATTERN)) {
+		i++;
+	}
+	return (words - i) * sizeof(uint32_t);
+}
+
+/*
+ * Fill the specified task's stack with the pattern word.
+ * NOTE: this overwrites the whole stack, so it must only be used on dead tasks.
+ */
+void kernel_fill_stack_with_pattern(struct TASK* task)
+{
+	kernel_paint_stack((uint32_t*)task_stack_bottom(task), task->descriptor->stack_size);
+}
+
+/*
+ * Return the maximum stack usage (high-water mark) of the task in bytes
+ */
+uint32_t kernel_get_stack_usage(struct TASK* task)
+{
+	return kernel_measure_stack_usage((uint32_t*)task_stack_bottom(task), task->descriptor->stack_size);
+}
+
+/*
+ * Return the maximum usage (high-water mark) in bytes of the stack used by the kernel
+ * initialization and by the exception handlers
+ */
+uint32_t kernel_get_kernel_stack_usage()
+{
+	return kernel_measure_stack_usage((uint32_t*)kernel_stack, sizeof(kernel_stack));
+}
+
+/*
+ * Estimate the maximum stack usage (in bytes) with a binary search of the boundary
+ * between the untouched pattern words and the used ones, so it costs O(log(stack_size)).
+ * Unused holes inside the used area (e.g. local buffers which were never entirely written) 
+ * may make it underestimate the usage: use kernel_get_stack_usage() for the exact value.
+ */
+uint32_t kernel_estimate_stack_usage(struct TASK* task)
+{
+	uint32_t* stack_bottom = (uint32_t*)task_stack_bottom(task);
+	uint32_t words = task->descriptor->stack_size / sizeof(uint32_t);
+	uint32_t low = 0;
+	uint32_t high = words;
+	uint32_t middle;
+	
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (stack_bottom[middle] == STACK_PATTERN) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return (words - low) * sizeof(uint32_t);
+}
+
+/*
+ * Return the time elapsed since boot in microseconds
+ */
+uint64_t kernel_get_time_us()
+{
+	return systick_get_time_us();
+}
+
+/*
+ * Return the time elapsed since boot in nanoseconds. The resolution is one SysTick count
+ * (8 HCLK cycles, i.e. ~111 ns at 72 MHz) and, unlike the cycle counter, it keeps 
+ * running while the core sleeps.
+ */
+uint64_t kernel_get_time_ns()
+{
+	return systick_get_time_ns();
+}
+
+/*
+ * Return the number of CPU cycles executed since the scheduler started (64 bits, so it 
+ * never wraps around in practice). NOTE: the core clock is stopped during WFI, so use
+ * kernel_get_time_us() to measure wall-clock time.
+ */
+uint64_t kernel_get_cycles()
+{
+	uint32_t irq_state = kernel_enter_critical();
+	uint32_t cycle_count, high;
+	
+	cycle_count = DWT->CYCCNT;
+	high = cycle_count_high;
+	// the counter wrapped after the last tick
+	if (cycle_count < last_cycle_count) {
+		high++;
+	}
+	kernel_exit_critical(irq_state);
+	return (((uint64_t)high) << 32) | cycle_count;
+}
+
+/*
+ * Block the active task on the wait list of an object (the list is ordered based on 
+ * priority, FIFO for tasks with the same priority) and give the CPU to the next ready task.
+ * Unless timeout is WAIT_FOREVER, the task is also put in the timer queue and it is
+ * woken up with KERNEL_TIMEOUT once the timeout (in ticks) expires. With a NO_WAIT 
+ * timeout, or when called from an interrupt handler, KERNEL_TIMEOUT is returned at once.
+ * This must be called inside a critical section, whose state is passed in irq_state: the 
+ * critical section is always left, so it must not be a nested one.
+ * Returns the result passed by the function which woke the task up.
+ */
+int32_t kernel_wait_on_list(struct TASK** wait_list, uint32_t timeout, uint32_t irq_state)
+{
+	if ((timeout == NO_WAIT) || kernel_is_in_interrupt()) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_TIMEOUT;
+	}
+	
+	kernel_remove_task_from_ready_list(active_task);
+	active_task->status = TASK_STATE_WAITING_FOR_OBJECT;
+	active_task->wait_list = wait_list;
+	active_task->wait_result = KERNEL_ERROR;
+	kernel_add_task_to_list(active_task, wait_list);
+	if (timeout != WAIT_FOREVER) {
+		kernel_add_task_to_timer_queue(active_task, timeout);
+	}
+	kernel_exit_critical(irq_state);
+	__asm("svc 1");
+	// Execution gets back here once the task has been woken up
+	return active_task->wait_result;
+}
+
+/*
+ * Wake up the first (i.e. highest priority) task waiting on the list, if any. 
+ * Must be called inside a critical section. Returns the task which was woken up.
+ */
+struct TASK* kernel_wake_up_waiting_task(struct TASK** wait_list, int32_t result)
+{
+	struct TASK* task_ptr = *wait_list;
+	
+	if (task_ptr != NULL) {
+		kernel_wake_up_task(task_ptr, result);
+	}
+	return task_ptr;
+}
+
+/*
+ * Remove the task from the wait list of the object it was waiting for and make it ready,
+ * preempting the active task if needed. Must be called inside a critical section.
+ */
+void kernel_wake_up_task(struct TASK* task_ptr, int32_t result)
+{
+	kernel_remove_task_from_list(task_ptr, task_ptr->wait_list);
+	task_ptr->wait_list = NULL;
+	kernel_remove_task_from_timer_queue(task_ptr);
+	task_ptr->wait_result = result;
+	kernel_add_task_to_ready_list(task_ptr);
+	kernel_check_for_context_switch();
+}
+
+/*
+ * Change the effective priority of the task (used for priority inheritance), moving it
+ * to the right place in the list it belongs to. The running task stays at the head of
+ * its new ready list. Must be called inside a critical section.
+ */
+void kernel_set_task_effective_priority(struct TASK* task_ptr, uint8_t priority)
+{
+	if (task_ptr->priority == priority) {
+		return;
+	}
+	
+	switch (task_ptr->status) {
+		case TASK_STATE_RUNNING:
+			kernel_remove_task_from_ready_list(task_ptr);
+			task_ptr->priority = priority;
+			task_ptr->next_task = ready_tasks_lists[priority];
+			if (ready_tasks_lists[priority] == NULL) {
+				ready_tasks_lists_tail[priority] = task_ptr;
+			}
+			ready_tasks_lists[priority] = task_ptr;
+			ready_priorities_bitmap |= PRIORITY_BIT(priority);
+			break;
+		case TASK_STATE_READY:
+			kernel_remove_task_from_ready_list(task_ptr);
+			task_ptr->priority = priority;
+			kernel_add_task_to_ready_list(task_ptr);
+			break;
+		case TASK_STATE_WAITING_FOR_OBJECT:
+			kernel_remove_task_from_list(task_ptr, task_ptr->wait_list);
+			task_ptr->priority = priority;
+			kernel_add_task_to_list(task_ptr, task_ptr->wait_list);
+			break;
+		default:
+			task_ptr->priority = priority;
+			break;
+	}
+	kernel_check_for_context_switch();
+}
+
+/*
+ * Return the task which is currently running
+ */
+struct TASK* kernel_get_active_task()
+{
+	return active_task;
+}
+
+/*
+ * Return TRUE if the caller is running in an exception handler
+ */
+uint8_t kernel_is_in_interrupt()
+{
+	return (__get_IPSR() != 0) ? TRUE : FALSE;
+}
+
+/*
+ * Enter a critical section: all the interrupts which may call kernel functions are
+ * masked through BASEPRI, whereas the ones with higher priority (lower priority value
+ * than KERNEL_MAX_SYSCALL_PRIORITY) are still served with no added latency.
+ * Critical sections can be nested and can be used from interrupt handlers: the 
+ * returned value must be passed to the matching kernel_exit_critical().
+ * NOTE: blocking kernel functions must not be called inside a critical section.
+ */
+uint32_t kernel_enter_critical()
+{
+	uint32_t irq_state = __get_BASEPRI();
+	
+	__set_BASEPRI_MAX(KERNEL_SYSCALL_BASEPRI);
+	__DSB();
+	__ISB();
+	return irq_state;
+}
+
+/*
+ * Leave a critical section, restoring the interrupt mask saved by kernel_enter_critical()
+ */
+void kernel_exit_critical(uint32_t irq_state)
+{
+	__set_BASEPRI(irq_state);
+}
+
+/*
+ * Set the function called by the idle task every time it is about to put the core to sleep.
+ * The hook runs in the idle task's context, so it must never block.
+ */
+void kernel_set_idle_hook(void (*hook)(void))
+{
+	idle_hook = hook;
+}
+
+/*
+ * Set the function called when a task overflows its stack. It is called by the PendSV
+ * handler, so it must be short and it must not block: it returns STACK_OVERFLOW_KILL or
+ * STACK_OVERFLOW_RESTART. With no hook the task is killed.
+ */
+void kernel_set_stack_overflow_hook(uint8_t (*hook)(struct TASK* task_ptr))
+{
+	stack_overflow_hook = hook;
+}
+
+/*
+ * Return the average CPU load (in 1/1000) over the last window_seconds seconds.
+ * Up to KERNEL_CPU_LOAD_HISTORY seconds are available.
+ */
+uint16_t kernel_get_cpu_load(uint8_t window_seconds)
+{
+	uint32_t sum = 0;
+	uint8_t index, i;
+	uint32_t irq_state;
+	
+	irq_state = kernel_enter_critical();
+	if (window_seconds > cpu_load_history_count) {
+		window_seconds = cpu_load_history_count;
+	}
+	index = cpu_load_history_index;
+	for (i = 0; i < window_seconds; i++) {
+		index = (index == 0) ? (KERNEL_CPU_LOAD_HISTORY - 1) : (index - 1);
+		sum += cpu_load_history[index];
+	}
+	kernel_exit_critical(irq_state);
+	
+	return (window_seconds == 0) ? 0 : (uint16_t)(sum / window_seconds);
+}
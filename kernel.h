@@ -12,10 +12,76 @@
 #define TASK_STATE_RUNNING 					0x01
 #define TASK_STATE_SLEEPING					0x02
 #define TASK_STATE_WAITING_FOR_RESUME		0x04
+#define TASK_STATE_READY					0x08
+#define TASK_STATE_WAITING_FOR_OBJECT		0x10
+
+// Return values of the blocking functions
+#define KERNEL_OK			0
+#define KERNEL_ERROR		-1
+#define KERNEL_TIMEOUT		-2
+
+// Priority levels: 0 is the highest priority, (KERNEL_PRIORITY_LEVELS-1) the lowest one
+#define KERNEL_PRIORITY_LEVELS		32
+#define KERNEL_IDLE_TASK_PRIORITY	(KERNEL_PRIORITY_LEVELS - 1)	// reserved to the kernel's idle task
+
+// Round-robin quantum (in ticks) given to new tasks. 0 disables time slicing, so the
+// task keeps the CPU until it releases it or a higher priority task preempts it.
+#define KERNEL_DEFAULT_TIME_SLICE	0
+
+// Tickless idle: when no task is ready the tick interrupt is stopped until the next
+// task's wakeup, provided that it is at least KERNEL_TICKLESS_IDLE_MIN_TICKS away.
+#define KERNEL_USE_TICKLESS_IDLE			1
+#define KERNEL_TICKLESS_IDLE_MIN_TICKS		2
+
+// Interrupts with a priority value lower than KERNEL_MAX_SYSCALL_PRIORITY (i.e. more urgent 
+// ones) are never masked by the kernel, but they must not call any kernel function. 
+// Interrupts which use kernel functions must have a priority value in the range
+// [KERNEL_MAX_SYSCALL_PRIORITY, 15].
+#define KERNEL_MAX_SYSCALL_PRIORITY		5
+
+// Stack overflow detection: at every context switch the saved stack pointer of the outgoing 
+// task is checked against the bottom of its stack, and so is the guard word at the bottom
+// (which is the stack pattern word, so it is written when the stack is filled).
+#define KERNEL_CHECK_STACK_OVERFLOW		1
+
+// Actions returned by the stack overflow hook
+#define STACK_OVERFLOW_KILL			0
+#define STACK_OVERFLOW_RESTART		1
+
+// Size of the buffer where interrupt handlers record the wakeups requested through the
+// _from_isr functions (it must be a power of 2)
+#define KERNEL_PENDING_WAKEUPS		8
+
+// Tasks created at runtime with kernel_task_create(): their control blocks and stacks are
+// taken from pools, with one pool for each stack size class
+#define KERNEL_MAX_DYNAMIC_TASKS		4
+#define KERNEL_STACK_SMALL_SIZE			256
+#define KERNEL_STACK_SMALL_COUNT		2
+#define KERNEL_STACK_MEDIUM_SIZE		512
+#define KERNEL_STACK_MEDIUM_COUNT		2
+#define KERNEL_STACK_LARGE_SIZE			1024
+#define KERNEL_STACK_LARGE_COUNT		1
+
+// Size (in bytes) of the stack used for the kernel initialization and for the exception handlers
+#define KERNEL_STACK_SIZE			1024
+
+// CPU load is sampled every second and the last KERNEL_CPU_LOAD_HISTORY samples are kept
+#define KERNEL_CPU_LOAD_HISTORY		60
 
 // Sleep options
 #define SLEEP_FOREVER		0xFFFFFFFF
 
+// Timeout options of the blocking functions (timeouts are expressed in ticks)
+#define NO_WAIT				0
+#define WAIT_FOREVER		0xFFFFFFFF
+
+// Task notification modes
+#define NOTIFY_SET			0x00	// overwrite the notification value
+#define NOTIFY_INCREMENT	0x01	// increment the notification value (the argument is ignored)
+#define NOTIFY_OR			0x02	// set the bits of the argument in the notification value
+
+struct MUTEX;
+
 // These are the registers automatically pushed on the current stack 
 // by the Cortex core on exception entering
 struct EXCEPTION_CONTEXT {
@@ -59,38 +125,82 @@ struct CONTEXT {
 	struct EXCEPTION_CONTEXT exc;
 };
 
+// Properties of a task which never change at runtime: static tasks keep them in flash
+struct TASK_DESCRIPTOR {
+	const char* name;
+	int32_t (*func)(void* arg);	// the returned value is the task's exit code
+	uint8_t* stack_top;		// last byte of the stack (the stack grows downwards from here)
+	uint32_t stack_size;	// NOTE: the stack size is expressed in bytes (it must be a multiple of 4)
+};
+
+// Control block of a task: only the data which changes at runtime. The byte-sized fields
+// are packed together; they are not bitfields, so that each one can be written without
+// a read-modify-write of its neighbours.
 struct TASK {
 	uint8_t* curr_stack_ptr;	// pointer to the current stack location
-	uint8_t* total_stack_ptr;	// pointer to the beginning of the stack
-	uint32_t stack_size;	// NOTE: the stack size is expressed in words (32 bits)
+	const struct TASK_DESCRIPTOR* descriptor;
 	uint8_t status;		// status of the task
-	uint8_t priority;
+	uint8_t priority;	// effective priority (it can be raised by priority inheritance)
+	uint8_t base_priority;	// priority assigned to the task
+	uint8_t notify_pending;	// TRUE if the task was notified and didn't get the notification yet
 	uint16_t id;
-	char* name;
-	void (*func)(void* arg); 
-	uint32_t resume_at_tickcount;
+	uint16_t time_slice;	// round-robin quantum in ticks (0 = no time slicing)
+	uint16_t time_slice_left;	// ticks left before the task is rotated with the other ones with the same priority
+	uint32_t timer_delta;	// ticks to wait after the previous task in the timer queue expired
 	struct TASK* next_task;
+	struct TASK* next_timer;	// next task in the timer queue
+	struct TASK* next_initialized_task;	// next task in the list of all the initialized tasks
+	struct TASK** wait_list;	// list of the object the task is waiting for (NULL if not waiting)
+	int32_t wait_result;	// value passed by the function which woke the task up
+	void* wait_data;	// data of the operation the task is waiting to complete (object specific)
+	struct MUTEX* owned_mutexes;	// list of the mutexes locked by the task
+	struct MUTEX* waiting_mutex;	// mutex the task is waiting for (NULL if none)
+	uint32_t notify_value;	// value of the direct-to-task notification
+	int32_t exit_code;	// value returned by the task's function (KERNEL_ERROR if the task was killed)
+	struct TASK* joining_tasks_list;	// tasks waiting for this task to terminate
 };
 
-#define ALLOCATE_TASK(_name_, _size_, _priority_, _main_func_)	\
-	uint8_t __attribute__((aligned(4))) _name_##_stack[_size_];	\
-	struct TASK _name_ = {	\
-		.total_stack_ptr = (_name_##_stack) + sizeof(_name_##_stack) - 1,	\
-		.curr_stack_ptr = (_name_##_stack) + sizeof(_name_##_stack) - 1,	\
-		.stack_size = _size_,	\
+// Initial value of a task's control block, shared by the static and the dynamic tasks
+#define KERNEL_TASK_INITIALIZER(_descriptor_, _stack_top_, _priority_)	\
+	{	\
+		.curr_stack_ptr = _stack_top_,	\
+		.descriptor = _descriptor_,	\
 		.priority = _priority_, \
-		.resume_at_tickcount = 0,	\
+		.base_priority = _priority_, \
+		.timer_delta = 0,	\
+		.time_slice = KERNEL_DEFAULT_TIME_SLICE,	\
+		.time_slice_left = 0,	\
 		.id = 0,	\
-		.name = #_name_, \
-		.func = _main_func_, \
 		.next_task = NULL,	\
+		.next_timer = NULL,	\
+		.next_initialized_task = NULL,	\
+		.wait_list = NULL,	\
+		.wait_result = KERNEL_OK,	\
+		.wait_data = NULL,	\
+		.owned_mutexes = NULL,	\
+		.waiting_mutex = NULL,	\
+		.notify_value = 0,	\
+		.notify_pending = FALSE,	\
+		.exit_code = KERNEL_OK,	\
+		.joining_tasks_list = NULL,	\
 		.status = TASK_STATE_DEAD,	\
-	};
+	}
+
+#define ALLOCATE_TASK(_name_, _size_, _priority_, _main_func_)	\
+	uint8_t __attribute__((aligned(4))) _name_##_stack[_size_];	\
+	const struct TASK_DESCRIPTOR _name_##_descriptor = {	\
+		.name = #_name_, \
+		.func = _main_func_, \
+		.stack_top = (_name_##_stack) + sizeof(_name_##_stack) - 1,	\
+		.stack_size = _size_,	\
+	};	\
+	struct TASK _name_ = KERNEL_TASK_INITIALIZER(&_name_##_descriptor, (_name_##_stack) + sizeof(_name_##_stack) - 1, _priority_);
 
 // Core functions
 void kernel_main(void);
 void pendsv_handler(void);
 void svc_handler(void);
+void kernel_process_ticks(uint32_t elapsed_ticks);
 
 // General purpose functions
 void kernel_init_task(struct TASK* task_ptr);
@@ -98,7 +208,36 @@ void kernel_activate_task_after_ms(struct TASK* task, uint32_t delay);
 void kernel_activate_task_immediately(struct TASK* task);
 void kernel_task_sleep(uint32_t sleep_time);
 uint8_t kernel_get_task_status(struct TASK* task_ptr);
+struct TASK* kernel_get_next_initialized_task(struct TASK* task_ptr);
+void kernel_fill_stack_with_pattern(struct TASK* task);
+uint32_t kernel_get_stack_usage(struct TASK* task);
+uint32_t kernel_get_kernel_stack_usage(void);
+uint32_t kernel_estimate_stack_usage(struct TASK* task);
+uint64_t kernel_get_time_us(void);
+uint64_t kernel_get_time_ns(void);
+uint64_t kernel_get_cycles(void);
+void kernel_set_idle_hook(void (*hook)(void));
+void kernel_set_stack_overflow_hook(uint8_t (*hook)(struct TASK* task_ptr));
+uint32_t kernel_enter_critical(void);
+void kernel_exit_critical(uint32_t irq_state);
+uint16_t kernel_get_cpu_load(uint8_t window_seconds);
 void kernel_task_kill(struct TASK* task_ptr);
+int32_t kernel_task_join(struct TASK* task_ptr, uint32_t timeout, int32_t* exit_code);
+struct TASK* kernel_task_create(const char* name, int32_t (*func)(void* arg), uint32_t stack_size, uint8_t priority);
+int32_t kernel_task_delete(struct TASK* task_ptr);
+void kernel_set_task_time_slice(struct TASK* task_ptr, uint16_t ticks);
+void kernel_notify(struct TASK* task_ptr, uint32_t value, uint8_t mode);
+int32_t kernel_notify_wait(uint32_t clear_mask, uint32_t* value, uint32_t timeout);
+void kernel_activate_task_from_isr(struct TASK* task_ptr);
+void kernel_notify_from_isr(struct TASK* task_ptr, uint32_t value, uint8_t mode);
+
+// Functions used to implement blocking objects (they must be called inside a critical section)
+int32_t kernel_wait_on_list(struct TASK** wait_list, uint32_t timeout, uint32_t irq_state);
+struct TASK* kernel_wake_up_waiting_task(struct TASK** wait_list, int32_t result);
+void kernel_wake_up_task(struct TASK* task_ptr, int32_t result);
+uint8_t kernel_is_in_interrupt(void);
+struct TASK* kernel_get_active_task(void);
+void kernel_set_task_effective_priority(struct TASK* task_ptr, uint8_t priority);
 
 // This macro must be used to define a module's initialization function
 #define MODULE_INIT_FUNCTION(name)   \
@@ -0,0 +1,82 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "mempool.h"
+
+/*
+ * Give all the blocks back to the pool and reset its statistics. Pools allocated with 
+ * ALLOCATE_MEMPOOL are already initialized, so this is only needed to reset a pool
+ * (none of its blocks must be in use).
+ */
+void kernel_mempool_init(struct MEMPOOL* pool)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	pool->free_list = NULL;
+	pool->unused_count = pool->block_count;
+	pool->free_count = pool->block_count;
+	pool->min_free_count = pool->block_count;
+	pool->failures = 0;
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Take a block from the pool in constant time. This can be called from interrupt handlers.
+ * Returns NULL if the pool is empty.
+ */
+void* kernel_mempool_alloc(struct MEMPOOL* pool)
+{
+	void* block;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	block = pool->free_list;
+	if (block != NULL) {
+		pool->free_list = *(void**)block;
+	} else if (pool->unused_count > 0) {
+		// the blocks which were never allocated are taken from the first one onwards
+		block = pool->buffer + ((pool->block_count - pool->unused_count) * pool->block_size);
+		pool->unused_count--;
+	}
+	if (block != NULL) {
+		pool->free_count--;
+		if (pool->free_count < pool->min_free_count) {
+			pool->min_free_count = pool->free_count;
+		}
+	} else {
+		pool->failures++;
+	}
+	kernel_exit_critical(irq_state);
+	return block;
+}
+
+/*
+ * Give the block back to the pool in constant time. This can be called from interrupt handlers.
+ * NOTE: the block must have been taken from the same pool.
+ */
+void kernel_mempool_free(struct MEMPOOL* pool, void* block)
+{
+	uint32_t irq_state;
+	
+	if (block == NULL) {
+		return;
+	}
+	irq_state = kernel_enter_critical();
+	*(void**)block = pool->free_list;
+	pool->free_list = block;
+	pool->free_count++;
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Get the usage statistics of the pool, which help sizing it from field data
+ */
+void kernel_mempool_get_stats(struct MEMPOOL* pool, struct MEMPOOL_STATS* stats)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	stats->block_size = pool->block_size;
+	stats->block_count = pool->block_count;
+	stats->used_count = pool->block_count - pool->free_count;
+	stats->max_used_count = pool->block_count - pool->min_free_count;
+	stats->failures = pool->failures;
+	kernel_exit_critical(irq_state);
+}
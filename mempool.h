@@ -0,0 +1,50 @@
+#ifndef _MEMPOOL_H_
+#define _MEMPOOL_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+// Pool of fixed-size blocks. Free blocks are linked through their first word, so
+// the block size is rounded up to a multiple of 4 bytes (and at least 4 bytes).
+// The blocks which were never allocated are not in the free list: they are taken in 
+// order from the buffer, so a pool is ready to use as soon as it is allocated.
+struct MEMPOOL {
+	uint8_t* buffer;
+	uint32_t block_size;	// size of each block (in bytes)
+	uint32_t block_count;	// total number of blocks
+	void* free_list;		// first freed block
+	uint32_t unused_count;	// blocks at the end of the buffer which were never allocated
+	uint32_t free_count;	// number of free blocks (freed or never allocated)
+	uint32_t min_free_count;	// lowest number of free blocks ever (high-water mark)
+	uint32_t failures;		// number of allocations failed because the pool was empty
+};
+
+#define MEMPOOL_BLOCK_SIZE(_size_)		((((_size_) + 3) & ~3UL) < 4 ? 4 : (((_size_) + 3) & ~3UL))
+
+#define ALLOCATE_MEMPOOL(_name_, _block_size_, _block_count_)	\
+	uint8_t __attribute__((aligned(8))) _name_##_buffer[MEMPOOL_BLOCK_SIZE(_block_size_) * (_block_count_)];	\
+	struct MEMPOOL _name_ = {	\
+		.buffer = _name_##_buffer,	\
+		.block_size = MEMPOOL_BLOCK_SIZE(_block_size_),	\
+		.block_count = _block_count_,	\
+		.free_list = NULL,	\
+		.unused_count = _block_count_,	\
+		.free_count = _block_count_,	\
+		.min_free_count = _block_count_,	\
+		.failures = 0,	\
+	};
+
+struct MEMPOOL_STATS {
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t used_count;	// blocks currently allocated
+	uint32_t max_used_count;	// highest number of blocks allocated at the same time
+	uint32_t failures;
+};
+
+void kernel_mempool_init(struct MEMPOOL* pool);
+void* kernel_mempool_alloc(struct MEMPOOL* pool);
+void kernel_mempool_free(struct MEMPOOL* pool, void* block);
+void kernel_mempool_get_stats(struct MEMPOOL* pool, struct MEMPOOL_STATS* stats);
+
+#endif // _MEMPOOL_H_
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "mutex.h"
+
+/*
+ * Give the mutex to the specified task
+ */
+static void mutex_set_owner(struct MUTEX* mutex, struct TASK* task_ptr)
+{
+	mutex->owner = task_ptr;
+	mutex->lock_count = 1;
+	mutex->next_owned_mutex = task_ptr->owned_mutexes;
+	task_ptr->owned_mutexes = mutex;
+}
+
+/*
+ * Remove the mutex from the list of the mutexes locked by its owner
+ */
+static void mutex_remove_from_owner(struct MUTEX* mutex)
+{
+	struct MUTEX** mutex_ptr = &mutex->owner->owned_mutexes;
+	
+	while (*mutex_ptr != NULL) {
+		if (*mutex_ptr == mutex) {
+			*mutex_ptr = mutex->next_owned_mutex;
+			break;
+		}
+		mutex_ptr = &(*mutex_ptr)->next_owned_mutex;
+	}
+	mutex->next_owned_mutex = NULL;
+}
+
+/*
+ * Raise the priority of the mutex's owner up to the specified one. If the owner is 
+ * in turn waiting for another mutex, the priority is propagated along the chain.
+ */
+static void mutex_inherit_priority(struct MUTEX* mutex, uint8_t priority)
+{
+	struct TASK* owner;
+	
+	while ((mutex != NULL) && (mutex->owner != NULL)) {
+		owner = mutex->owner;
+		if (owner->priority <= priority) {
+			break;
+		}
+		kernel_set_task_effective_priority(owner, priority);
+		mutex = owner->waiting_mutex;
+	}
+}
+
+/*
+ * Compute the task's effective priority again: this is the highest one among its own 
+ * priority and the ones of the tasks waiting for the mutexes it still owns.
+ */
+static void mutex_update_owner_priority(struct TASK* task_ptr)
+{
+	uint8_t priority = task_ptr->base_priority;
+	struct MUTEX* mutex = task_ptr->owned_mutexes;
+	
+	while (mutex != NULL) {
+		// wait lists are ordered, so the first task has the highest priority
+		if ((mutex->waiting_tasks_list != NULL) && (mutex->waiting_tasks_list->priority < priority)) {
+			priority = mutex->waiting_tasks_list->priority;
+		}
+		mutex = mutex->next_owned_mutex;
+	}
+	kernel_set_task_effective_priority(task_ptr, priority);
+}
+
+/*
+ * A task stopped waiting for the mutex without getting it: the priority it lent to the 
+ * owner must be taken back, along the whole chain of owners it was propagated to.
+ */
+static void mutex_restore_inherited_priority(struct MUTEX* mutex)
+{
+	struct TASK* owner;
+	uint8_t old_priority;
+	
+	while ((mutex != NULL) && (mutex->owner != NULL)) {
+		owner = mutex->owner;
+		old_priority = owner->priority;
+		mutex_update_owner_priority(owner);
+		if (owner->priority == old_priority) {
+			break;
+		}
+		mutex = owner->waiting_mutex;
+	}
+}
+
+/*
+ * Lock the mutex, blocking the calling task for at most timeout ticks until it is available.
+ * The same task can lock the mutex several times, and it must then unlock it the same 
+ * number of times. While the task waits, the owner inherits its priority so that it 
+ * cannot be delayed by tasks with intermediate priority (priority inversion).
+ * Mutexes cannot be used from interrupt handlers.
+ * Returns KERNEL_OK, KERNEL_TIMEOUT or KERNEL_ERROR.
+ */
+int32_t kernel_mutex_lock(struct MUTEX* mutex, uint32_t timeout)
+{
+	struct TASK* active_task = kernel_get_active_task();
+	uint32_t irq_state;
+	
+	if (kernel_is_in_interrupt()) {
+		return KERNEL_ERROR;
+	}
+	
+	irq_state = kernel_enter_critical();
+	if (mutex->owner == NULL) {
+		mutex_set_owner(mutex, active_task);
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	if (mutex->owner == active_task) {
+		mutex->lock_count++;
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	if (timeout == NO_WAIT) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_TIMEOUT;
+	}
+	
+	mutex_inherit_priority(mutex, active_task->priority);
+	active_task->waiting_mutex = mutex;
+	// The ownership is handed over directly by kernel_mutex_unlock(). If the wait fails 
+	// the kernel calls kernel_mutex_cancel_wait() as soon as the task leaves the wait list.
+	return kernel_wait_on_list(&mutex->waiting_tasks_list, timeout, irq_state);
+}
+
+/*
+ * Lock the mutex only if it is immediately available (or already owned by the caller)
+ */
+int32_t kernel_mutex_try_lock(struct MUTEX* mutex)
+{
+	struct TASK* active_task = kernel_get_active_task();
+	int32_t ret = KERNEL_OK;
+	uint32_t irq_state;
+	
+	if (kernel_is_in_interrupt()) {
+		return KERNEL_ERROR;
+	}
+	
+	irq_state = kernel_enter_critical();
+	if (mutex->owner == NULL) {
+		mutex_set_owner(mutex, active_task);
+	} else if (mutex->owner == active_task) {
+		mutex->lock_count++;
+	} else {
+		ret = KERNEL_ERROR;
+	}
+	kernel_exit_critical(irq_state);
+	return ret;
+}
+
+/*
+ * Unlock the mutex. Once the last nested lock is released the owner gets back its
+ * own priority (or the one inherited through the other mutexes it owns) and the mutex
+ * is handed over to the highest priority waiting task.
+ * Returns KERNEL_ERROR if the caller does not own the mutex.
+ */
+int32_t kernel_mutex_unlock(struct MUTEX* mutex)
+{
+	struct TASK* active_task = kernel_get_active_task();
+	struct TASK* next_owner;
+	uint32_t irq_state;
+	
+	if (kernel_is_in_interrupt()) {
+		return KERNEL_ERROR;
+	}
+	
+	irq_state = kernel_enter_critical();
+	if (mutex->owner != active_task) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_ERROR;
+	}
+	if (--mutex->lock_count > 0) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	
+	mutex_remove_from_owner(mutex);
+	mutex->owner = NULL;
+	next_owner = mutex->waiting_tasks_list;
+	if (next_owner != NULL) {
+		next_owner->waiting_mutex = NULL;
+		kernel_wake_up_task(next_owner, KERNEL_OK);
+		mutex_set_owner(mutex, next_owner);
+		// the remaining waiters can only have lower (or equal) priority than the new owner
+	}
+	mutex_update_owner_priority(active_task);
+	kernel_exit_critical(irq_state);
+	return KERNEL_OK;
+}
+
+/*
+ * The task was removed from the wait list of a mutex without getting it (its timeout
+ * expired or it was killed or activated): the priority it lent to the owner is taken
+ * back at once, so that the owner doesn't keep running at a priority it has no claim to.
+ * Must be called inside a critical section.
+ */
+void kernel_mutex_cancel_wait(struct TASK* task_ptr)
+{
+	struct MUTEX* mutex = task_ptr->waiting_mutex;
+	
+	if (mutex != NULL) {
+		task_ptr->waiting_mutex = NULL;
+		mutex_restore_inherited_priority(mutex);
+	}
+}
+
+/*
+ * Clean up the mutexes of a task which terminated (it returned from its function or it 
+ * was killed), which must already be removed from any wait list. The priority it lent 
+ * to the owner of the mutex it was waiting for is taken back and each mutex it owns 
+ * is handed over to the highest priority waiting task (or unlocked).
+ * Must be called inside a critical section.
+ */
+void kernel_mutex_release_task(struct TASK* task_ptr)
+{
+	struct MUTEX* mutex;
+	struct TASK* next_owner;
+	
+	kernel_mutex_cancel_wait(task_ptr);
+	while ((mutex = task_ptr->owned_mutexes) != NULL) {
+		task_ptr->owned_mutexes = mutex->next_owned_mutex;
+		mutex->next_owned_mutex = NULL;
+		mutex->owner = NULL;
+		mutex->lock_count = 0;
+		next_owner = mutex->waiting_tasks_list;
+		if (next_owner != NULL) {
+			next_owner->waiting_mutex = NULL;
+			kernel_wake_up_task(next_owner, KERNEL_OK);
+			mutex_set_owner(mutex, next_owner);
+		}
+	}
+}
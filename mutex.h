@@ -0,0 +1,30 @@
+#ifndef _MUTEX_H_
+#define _MUTEX_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+struct MUTEX {
+	struct TASK* owner;		// task which locked the mutex (NULL if unlocked)
+	uint32_t lock_count;	// number of nested locks done by the owner
+	struct TASK* waiting_tasks_list;	// tasks waiting for the mutex (ordered based on priority)
+	struct MUTEX* next_owned_mutex;		// next mutex locked by the same owner
+};
+
+#define ALLOCATE_MUTEX(_name_)	\
+	struct MUTEX _name_ = {	\
+		.owner = NULL,	\
+		.lock_count = 0,	\
+		.waiting_tasks_list = NULL,	\
+		.next_owned_mutex = NULL,	\
+	};
+
+int32_t kernel_mutex_lock(struct MUTEX* mutex, uint32_t timeout);
+int32_t kernel_mutex_try_lock(struct MUTEX* mutex);
+int32_t kernel_mutex_unlock(struct MUTEX* mutex);
+
+// Used by the kernel when a task stops waiting or terminates (they must be called inside a critical section)
+void kernel_mutex_cancel_wait(struct TASK* task_ptr);
+void kernel_mutex_release_task(struct TASK* task_ptr);
+
+#endif // _MUTEX_H_
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "queue.h"
+
+/*
+ * Copy a message. Messages of pointer queues are moved with a single word access.
+ */
+static void queue_copy_item(void* dst, const void* src, uint32_t size)
+{
+	uint8_t* dst_ptr = (uint8_t*)dst;
+	const uint8_t* src_ptr = (const uint8_t*)src;
+	
+	if (size == sizeof(uint32_t)) {
+		*(uint32_t*)dst = *(const uint32_t*)src;
+		return;
+	}
+	while (size > 0) {
+		*dst_ptr++ = *src_ptr++;
+		size--;
+	}
+}
+
+/*
+ * Store the message in the first free slot of the ring
+ */
+static void queue_push(struct QUEUE* queue, const void* item)
+{
+	queue_copy_item(queue->buffer + (queue->write_index * queue->item_size), item, queue->item_size);
+	queue->write_index++;
+	if (queue->write_index == queue->capacity) {
+		queue->write_index = 0;
+	}
+	queue->count++;
+}
+
+/*
+ * Take the oldest message from the ring
+ */
+static void queue_pop(struct QUEUE* queue, void* item)
+{
+	queue_copy_item(item, queue->buffer + (queue->read_index * queue->item_size), queue->item_size);
+	queue->read_index++;
+	if (queue->read_index == queue->capacity) {
+		queue->read_index = 0;
+	}
+	queue->count--;
+}
+
+/*
+ * Send a message (item_size bytes are copied from item). If the queue is full the calling
+ * task waits for a free slot for at most timeout ticks. When a task is already waiting 
+ * for a message, the message is copied straight into its buffer.
+ * This can be called from interrupt handlers, where it never blocks.
+ * Returns KERNEL_OK or KERNEL_TIMEOUT.
+ */
+int32_t kernel_queue_send(struct QUEUE* queue, const void* item, uint32_t timeout)
+{
+	struct TASK* receiver;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	receiver = queue->waiting_receivers_list;
+	if (receiver != NULL) {
+		queue_copy_item(receiver->wait_data, item, queue->item_size);
+		kernel_wake_up_task(receiver, KERNEL_OK);
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	if (queue->count < queue->capacity) {
+		queue_push(queue, item);
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	// The queue is full: the message will be copied by the receiver which frees a slot.
+	// Interrupt handlers must not touch the data of the interrupted task.
+	if ((timeout == NO_WAIT) || kernel_is_in_interrupt()) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_TIMEOUT;
+	}
+	kernel_get_active_task()->wait_data = (void*)item;
+	return kernel_wait_on_list(&queue->waiting_senders_list, timeout, irq_state);
+}
+
+/*
+ * Receive the oldest message (item_size bytes are copied to item). If the queue is empty
+ * the calling task waits for a message for at most timeout ticks. When a task is waiting
+ * to send, its message is moved into the slot which has just been freed.
+ * Returns KERNEL_OK or KERNEL_TIMEOUT.
+ */
+int32_t kernel_queue_receive(struct QUEUE* queue, void* item, uint32_t timeout)
+{
+	struct TASK* sender;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (queue->count > 0) {
+		queue_pop(queue, item);
+		sender = queue->waiting_senders_list;
+		if (sender != NULL) {
+			queue_push(queue, sender->wait_data);
+			kernel_wake_up_task(sender, KERNEL_OK);
+		}
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	// The queue is empty: the message will be copied by the sender
+	if ((timeout == NO_WAIT) || kernel_is_in_interrupt()) {
+		kernel_exit_critical(irq_state);
+		return KERNEL_TIMEOUT;
+	}
+	kernel_get_active_task()->wait_data = item;
+	return kernel_wait_on_list(&queue->waiting_receivers_list, timeout, irq_state);
+}
+
+/*
+ * Zero-copy send: only the pointer is queued, the ownership of the pointed buffer
+ * passes to the receiver
+ */
+int32_t kernel_queue_send_ptr(struct QUEUE* queue, void* ptr, uint32_t timeout)
+{
+	return kernel_queue_send(queue, &ptr, timeout);
+}
+
+/*
+ * Zero-copy receive: get the pointer to the oldest message
+ */
+int32_t kernel_queue_receive_ptr(struct QUEUE* queue, void** ptr, uint32_t timeout)
+{
+	return kernel_queue_receive(queue, ptr, timeout);
+}
+
+/*
+ * Return the number of messages in the queue
+ */
+uint32_t kernel_queue_get_count(struct QUEUE* queue)
+{
+	return queue->count;
+}
@@ -0,0 +1,41 @@
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+struct QUEUE {
+	uint8_t* buffer;		// ring storage for the messages
+	uint32_t item_size;		// size of each message (in bytes)
+	uint32_t capacity;		// maximum number of messages in the queue
+	uint32_t count;			// number of messages in the queue
+	uint32_t read_index;	// slot of the oldest message
+	uint32_t write_index;	// first free slot
+	struct TASK* waiting_senders_list;		// tasks waiting for a free slot (ordered based on priority)
+	struct TASK* waiting_receivers_list;	// tasks waiting for a message (ordered based on priority)
+};
+
+#define ALLOCATE_QUEUE(_name_, _item_size_, _capacity_)	\
+	uint8_t __attribute__((aligned(4))) _name_##_buffer[(_item_size_) * (_capacity_)];	\
+	struct QUEUE _name_ = {	\
+		.buffer = _name_##_buffer,	\
+		.item_size = _item_size_,	\
+		.capacity = _capacity_,	\
+		.count = 0,	\
+		.read_index = 0,	\
+		.write_index = 0,	\
+		.waiting_senders_list = NULL,	\
+		.waiting_receivers_list = NULL,	\
+	};
+
+// Zero-copy queue: only pointers to the messages (e.g. buffers taken from a pool) are 
+// passed, so large messages are never copied between the producer and the consumer
+#define ALLOCATE_POINTER_QUEUE(_name_, _capacity_)		ALLOCATE_QUEUE(_name_, sizeof(void*), _capacity_)
+
+int32_t kernel_queue_send(struct QUEUE* queue, const void* item, uint32_t timeout);
+int32_t kernel_queue_receive(struct QUEUE* queue, void* item, uint32_t timeout);
+int32_t kernel_queue_send_ptr(struct QUEUE* queue, void* ptr, uint32_t timeout);
+int32_t kernel_queue_receive_ptr(struct QUEUE* queue, void** ptr, uint32_t timeout);
+uint32_t kernel_queue_get_count(struct QUEUE* queue);
+
+#endif // _QUEUE_H_
\ No newline at end of file
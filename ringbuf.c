@@ -0,0 +1,125 @@
+#include "stdint.h"
+#include "stm32f103xb.h"
+#include "kernel.h"
+#include "systick.h"
+#include "ringbuf.h"
+
+/*
+ * Check the buffer's size and empty it. This must be called once, before the buffer is 
+ * used (e.g. from a module's initialization function).
+ * Returns KERNEL_ERROR if the size is not a power of 2, since the indexes are wrapped
+ * with a mask.
+ */
+int32_t kernel_ring_buffer_init(struct RING_BUFFER* ring)
+{
+	if ((ring->size == 0) || ((ring->size & (ring->size - 1)) != 0)) {
+		return KERNEL_ERROR;
+	}
+	ring->write_index = 0;
+	ring->read_index = 0;
+	ring->waiting_consumer = NULL;
+	return KERNEL_OK;
+}
+
+/*
+ * Write up to length bytes (producer side). Each index is written only by its owner
+ * with a single word store, so no critical section is needed: the barrier makes sure 
+ * the data is in memory before the consumer can see the new index.
+ * The consumer task is woken up only if it is blocked on the empty buffer.
+ * This can be called from interrupt handlers.
+ * Returns the number of bytes written (less than length if the buffer is full).
+ */
+uint32_t kernel_ring_buffer_write(struct RING_BUFFER* ring, const uint8_t* data, uint32_t length)
+{
+	uint32_t write_index = ring->write_index;
+	uint32_t free_space = ring->size - (write_index - ring->read_index);
+	uint32_t irq_state;
+	uint32_t i;
+	
+	if (length > free_space) {
+		length = free_space;
+	}
+	for (i = 0; i < length; i++) {
+		ring->buffer[(write_index + i) & (ring->size - 1)] = data[i];
+	}
+	__DMB();
+	ring->write_index = write_index + length;
+	
+	if ((length > 0) && (ring->waiting_consumer != NULL)) {
+		irq_state = kernel_enter_critical();
+		kernel_wake_up_waiting_task(&ring->waiting_consumer, KERNEL_OK);
+		kernel_exit_critical(irq_state);
+	}
+	return length;
+}
+
+/*
+ * Read up to length bytes (consumer side) without blocking.
+ * Returns the number of bytes read.
+ */
+uint32_t kernel_ring_buffer_read(struct RING_BUFFER* ring, uint8_t* data, uint32_t length)
+{
+	uint32_t read_index = ring->read_index;
+	uint32_t count = ring->write_index - read_index;
+	uint32_t i;
+	
+	if (length > count) {
+		length = count;
+	}
+	// the data written by the producer must be read only after its index
+	__DMB();
+	for (i = 0; i < length; i++) {
+		data[i] = ring->buffer[(read_index + i) & (ring->size - 1)];
+	}
+	__DMB();
+	ring->read_index = read_index + length;
+	return length;
+}
+
+/*
+ * Read up to length bytes, waiting for at most timeout ticks while the buffer is empty.
+ * If the consumer is woken up and finds no data, it only waits for what is left of the timeout.
+ * The emptiness check is done in a critical section, so a write can't get lost between
+ * the check and the wait; while data is available no critical section is entered at all.
+ * Returns the number of bytes read or KERNEL_TIMEOUT.
+ */
+int32_t kernel_ring_buffer_read_wait(struct RING_BUFFER* ring, uint8_t* data, uint32_t length, uint32_t timeout)
+{
+	uint64_t start_tick = systick_get_tick_count64();
+	uint64_t elapsed_ticks;
+	uint32_t wait_ticks = timeout;
+	uint32_t irq_state;
+	uint32_t count;
+	int32_t ret;
+	
+	if (length == 0) {
+		return 0;
+	}
+	while ((count = kernel_ring_buffer_read(ring, data, length)) == 0) {
+		if ((timeout != WAIT_FOREVER) && (timeout != NO_WAIT)) {
+			elapsed_ticks = systick_get_tick_count64() - start_tick;
+			if (elapsed_ticks >= timeout) {
+				return KERNEL_TIMEOUT;
+			}
+			wait_ticks = timeout - (uint32_t)elapsed_ticks;
+		}
+		irq_state = kernel_enter_critical();
+		if (ring->write_index != ring->read_index) {
+			kernel_exit_critical(irq_state);
+			continue;
+		}
+		ret = kernel_wait_on_list(&ring->waiting_consumer, wait_ticks, irq_state);
+		if (ret != KERNEL_OK) {
+			return ret;
+		}
+	}
+	return (int32_t)count;
+}
+
+/*
+ * Return the number of bytes in the buffer
+ */
+uint32_t kernel_ring_buffer_get_count(struct RING_BUFFER* ring)
+{
+	return ring->write_index - ring->read_index;
+}
@@ -0,0 +1,33 @@
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+// Single-producer/single-consumer byte stream (e.g. interrupt handler -> task). 
+// NOTE: the size must be a power of 2 (it is checked by kernel_ring_buffer_init()).
+struct RING_BUFFER {
+	uint8_t* buffer;
+	uint32_t size;
+	volatile uint32_t write_index;	// free running, written by the producer only
+	volatile uint32_t read_index;	// free running, written by the consumer only
+	struct TASK* waiting_consumer;	// consumer task blocked on the empty buffer (if any)
+};
+
+#define ALLOCATE_RING_BUFFER(_name_, _size_)	\
+	uint8_t _name_##_buffer[_size_];	\
+	struct RING_BUFFER _name_ = {	\
+		.buffer = _name_##_buffer,	\
+		.size = _size_,	\
+		.write_index = 0,	\
+		.read_index = 0,	\
+		.waiting_consumer = NULL,	\
+	};
+
+int32_t kernel_ring_buffer_init(struct RING_BUFFER* ring);
+uint32_t kernel_ring_buffer_write(struct RING_BUFFER* ring, const uint8_t* data, uint32_t length);
+uint32_t kernel_ring_buffer_read(struct RING_BUFFER* ring, uint8_t* data, uint32_t length);
+int32_t kernel_ring_buffer_read_wait(struct RING_BUFFER* ring, uint8_t* data, uint32_t length, uint32_t timeout);
+uint32_t kernel_ring_buffer_get_count(struct RING_BUFFER* ring);
+
+#endif // _RINGBUF_H_
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "semaphore.h"
+
+/*
+ * Take a token from the semaphore, blocking the calling task for at most timeout ticks
+ * until one is available. Waiting tasks are served in priority order. When called from
+ * an interrupt handler it never blocks.
+ * Returns KERNEL_OK or KERNEL_TIMEOUT.
+ */
+int32_t kernel_sem_take(struct SEMAPHORE* sem, uint32_t timeout)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (sem->count > 0) {
+		sem->count--;
+		kernel_exit_critical(irq_state);
+		return KERNEL_OK;
+	}
+	// The token is handed over directly by kernel_sem_give()
+	return kernel_wait_on_list(&sem->waiting_tasks_list, timeout, irq_state);
+}
+
+/*
+ * Take a token from the semaphore only if one is immediately available.
+ * This can be called from interrupt handlers.
+ */
+int32_t kernel_sem_try_take(struct SEMAPHORE* sem)
+{
+	int32_t ret = KERNEL_ERROR;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (sem->count > 0) {
+		sem->count--;
+		ret = KERNEL_OK;
+	}
+	kernel_exit_critical(irq_state);
+	return ret;
+}
+
+/*
+ * Give a token to the semaphore. If some task is waiting the token is passed directly
+ * to the highest priority one, which is made ready (and preempts the caller if it has
+ * a higher priority). This can be called from interrupt handlers.
+ * Returns KERNEL_ERROR if the semaphore already reached its maximum count.
+ */
+int32_t kernel_sem_give(struct SEMAPHORE* sem)
+{
+	int32_t ret = KERNEL_OK;
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (kernel_wake_up_waiting_task(&sem->waiting_tasks_list, KERNEL_OK) == NULL) {
+		if (sem->count < sem->max_count) {
+			sem->count++;
+		} else {
+			ret = KERNEL_ERROR;
+		}
+	}
+	kernel_exit_critical(irq_state);
+	return ret;
+}
+
+/*
+ * Return the number of available tokens
+ */
+uint32_t kernel_sem_get_count(struct SEMAPHORE* sem)
+{
+	return sem->count;
+}
@@ -0,0 +1,25 @@
+#ifndef _SEMAPHORE_H_
+#define _SEMAPHORE_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+struct SEMAPHORE {
+	uint32_t count;		// number of available tokens
+	uint32_t max_count;
+	struct TASK* waiting_tasks_list;	// tasks waiting for a token (ordered based on priority)
+};
+
+#define ALLOCATE_SEMAPHORE(_name_, _initial_count_, _max_count_)	\
+	struct SEMAPHORE _name_ = {	\
+		.count = _initial_count_,	\
+		.max_count = _max_count_,	\
+		.waiting_tasks_list = NULL,	\
+	};
+
+int32_t kernel_sem_take(struct SEMAPHORE* sem, uint32_t timeout);
+int32_t kernel_sem_try_take(struct SEMAPHORE* sem);
+int32_t kernel_sem_give(struct SEMAPHORE* sem);
+uint32_t kernel_sem_get_count(struct SEMAPHORE* sem);
+
+#endif // _SEMAPHORE_H_
\ No newline at end of file
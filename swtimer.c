@@ -0,0 +1,182 @@
+#include "stdint.h"
+#include "kernel.h"
+#include "systick.h"
+#include "swtimer.h"
+
+// Private variables
+struct SW_TIMER* timer_wheel[SW_TIMER_WHEEL_SIZE];  // active timers, hashed on their expiration tick
+uint64_t last_processed_tick = 0;  // last tick whose wheel slot has been processed
+static int32_t timer_service_task_func(void* arg);
+ALLOCATE_TASK(timer_service, SW_TIMER_TASK_STACK_SIZE, SW_TIMER_TASK_PRIORITY, timer_service_task_func)
+
+#define wheel_slot(_tick_)		(timer_wheel[(_tick_) & (SW_TIMER_WHEEL_SIZE - 1)])
+
+/*
+ * Remove the timer from its wheel slot. Must be called inside a critical section.
+ */
+static void timer_remove_from_wheel(struct SW_TIMER* timer)
+{
+	struct SW_TIMER** timer_ptr = &wheel_slot(timer->expire_tick);
+	
+	while (*timer_ptr != NULL) {
+		if (*timer_ptr == timer) {
+			*timer_ptr = timer->next_timer;
+			break;
+		}
+		timer_ptr = &(*timer_ptr)->next_timer;
+	}
+	timer->next_timer = NULL;
+}
+
+/*
+ * Add the timer to the slot of its expiration tick. Must be called inside a critical section.
+ */
+static void timer_add_to_wheel(struct SW_TIMER* timer)
+{
+	timer->next_timer = wheel_slot(timer->expire_tick);
+	wheel_slot(timer->expire_tick) = timer;
+}
+
+/*
+ * Take the first timer of the slot which expired at or before now, if any. Periodic
+ * timers are armed again before their callback runs, so that the callback can stop them.
+ * Must be called inside a critical section.
+ */
+static struct SW_TIMER* timer_get_expired(struct SW_TIMER* slot, uint64_t now)
+{
+	while ((slot != NULL) && (slot->expire_tick > now)) {
+		slot = slot->next_timer;
+	}
+	if (slot == NULL) {
+		return NULL;
+	}
+	
+	timer_remove_from_wheel(slot);
+	if (slot->period != 0) {
+		slot->expire_tick += slot->period;
+		// skip the periods which were missed
+		if (slot->expire_tick <= now) {
+			slot->expire_tick = now + slot->period;
+		}
+		timer_add_to_wheel(slot);
+	} else {
+		slot->active = FALSE;
+	}
+	return slot;
+}
+
+/*
+ * Return the number of ticks until the first non-empty slot of the wheel, or WAIT_FOREVER
+ * if there's no active timer. Timers in that slot may belong to a later revolution: in 
+ * this case the service simply wakes up, finds nothing to do and waits again.
+ */
+static uint32_t timer_get_next_wakeup(uint64_t now)
+{
+	uint32_t ticks;
+	
+	for (ticks = 1; ticks <= SW_TIMER_WHEEL_SIZE; ticks++) {
+		if (wheel_slot(now + ticks) != NULL) {
+			return ticks;
+		}
+	}
+	return WAIT_FOREVER;
+}
+
+/*
+ * Timer service task: process the wheel slots of the ticks elapsed since its last run, 
+ * calling the callbacks of the expired timers, and wait for the next expiration. The
+ * task is notified whenever a timer is started, so that the wait is computed again.
+ */
+static int32_t timer_service_task_func(void* arg)
+{
+	struct SW_TIMER* timer;
+	uint64_t now;
+	uint32_t slots, irq_state;
+	void (*callback)(void* arg);
+	void* callback_arg;
+	
+	last_processed_tick = systick_get_tick_count64();
+	while (1) {
+		now = systick_get_tick_count64();
+		// after a long delay each slot must be visited only once
+		slots = ((now - last_processed_tick) > SW_TIMER_WHEEL_SIZE) ? SW_TIMER_WHEEL_SIZE : (uint32_t)(now - last_processed_tick);
+		while (slots > 0) {
+			last_processed_tick++;
+			do {
+				irq_state = kernel_enter_critical();
+				timer = timer_get_expired(wheel_slot(last_processed_tick), now);
+				if (timer != NULL) {
+					callback = timer->callback;
+					callback_arg = timer->arg;
+				}
+				kernel_exit_critical(irq_state);
+				if (timer != NULL) {
+					callback(callback_arg);
+				}
+			} while (timer != NULL);
+			slots--;
+		}
+		last_processed_tick = now;
+		
+		irq_state = kernel_enter_critical();
+		// the callbacks may have taken longer than a tick: process the new ticks at once
+		slots = (systick_get_tick_count64() != now) ? NO_WAIT : timer_get_next_wakeup(now);
+		kernel_exit_critical(irq_state);
+		kernel_notify_wait(0xFFFFFFFF, NULL, slots);
+	}
+	return KERNEL_OK;
+}
+
+/*
+ * Start (or restart) the timer: the callback is called after delay ticks and then, if
+ * period is not 0, every period ticks. This can be called from interrupt handlers.
+ */
+void kernel_timer_start(struct SW_TIMER* timer, uint32_t delay, uint32_t period)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (timer->active) {
+		timer_remove_from_wheel(timer);
+	}
+	if (delay == 0) {
+		delay = 1;
+	}
+	timer->period = period;
+	timer->expire_tick = systick_get_tick_count64() + delay;
+	timer->active = TRUE;
+	timer_add_to_wheel(timer);
+	kernel_exit_critical(irq_state);
+	// let the timer service compute its wakeup again
+	kernel_notify(&timer_service, 0, NOTIFY_INCREMENT);
+}
+
+/*
+ * Stop the timer. This can be called from interrupt handlers and from the timer's own callback.
+ */
+void kernel_timer_stop(struct SW_TIMER* timer)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	
+	if (timer->active) {
+		timer_remove_from_wheel(timer);
+		timer->active = FALSE;
+	}
+	kernel_exit_critical(irq_state);
+}
+
+/*
+ * Return TRUE if the timer is running
+ */
+uint8_t kernel_timer_is_active(struct SW_TIMER* timer)
+{
+	return timer->active;
+}
+
+/*
+ * Initialization function
+ */
+MODULE_INIT_FUNCTION(swtimer)
+{
+	kernel_init_task(&timer_service);
+	kernel_activate_task_immediately(&timer_service);
+}
@@ -0,0 +1,39 @@
+#ifndef _SWTIMER_H_
+#define _SWTIMER_H_
+
+#include "stdint.h"
+#include "kernel.h"
+
+// Timer service task configuration. Callbacks run in this task, so they must be short
+// and they must not block.
+#define SW_TIMER_TASK_PRIORITY		1
+#define SW_TIMER_TASK_STACK_SIZE	512
+
+// Number of slots of the timer wheel (it must be a power of 2). Timers expiring farther
+// than this number of ticks wake the timer service up once per wheel revolution.
+#define SW_TIMER_WHEEL_SIZE			64
+
+struct SW_TIMER {
+	void (*callback)(void* arg);
+	void* arg;
+	uint32_t period;		// reload value in ticks (0 for one-shot timers)
+	uint64_t expire_tick;	// tick count at which the timer expires
+	struct SW_TIMER* next_timer;	// next timer in the same wheel slot
+	uint8_t active;
+};
+
+#define ALLOCATE_SW_TIMER(_name_, _callback_, _arg_)	\
+	struct SW_TIMER _name_ = {	\
+		.callback = _callback_,	\
+		.arg = _arg_,	\
+		.period = 0,	\
+		.expire_tick = 0,	\
+		.next_timer = NULL,	\
+		.active = FALSE,	\
+	};
+
+void kernel_timer_start(struct SW_TIMER* timer, uint32_t delay, uint32_t period);
+void kernel_timer_stop(struct SW_TIMER* timer);
+uint8_t kernel_timer_is_active(struct SW_TIMER* timer);
+
+#endif // _SWTIMER_H_
\ No newline at end of file
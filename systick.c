@@ -2,18 +2,26 @@
 #include "systick.h"
 #include "stm32f103xb.h"
 #include "clock.h"
+#include "kernel.h"
+#include "utils.h"
 
-/* 1 ms per tick. */
-#define TICK_RATE_HZ	1000
+#define US_PER_TICK		(1000000 / TICK_RATE_HZ)
+#define NS_PER_TICK		(1000000000 / TICK_RATE_HZ)
+#define CYCLES_PER_COUNT	8	// SysTick is clocked by HCLK/8
 
-uint32_t tick_count = 0;
+uint64_t tick_count = 0;
+uint32_t counts_per_tick;	// SysTick counts in one tick period
+uint32_t max_sleep_ticks;	// longest period which fits in the 24 bits SysTick counter
+uint32_t stopped_cycles = 0;	// HCLK cycles spent with SysTick stopped which are not accounted yet
 
 /*
  * Initialize the SysTick module in order to have 1 interrupt every millisecond
  */
 void systick_init()
 {
-  SysTick->LOAD  = (uint32_t)((clock_get_HCLK_freq()/(8*TICK_RATE_HZ)) - 1UL);                         
+  counts_per_tick = clock_get_HCLK_freq()/(CYCLES_PER_COUNT*TICK_RATE_HZ);
+  max_sleep_ticks = SysTick_LOAD_RELOAD_Msk / counts_per_tick;
+  SysTick->LOAD  = (uint32_t)(counts_per_tick - 1UL);                         
   NVIC_SetPriority (SysTick_IRQn, (1UL << __NVIC_PRIO_BITS) - 1UL); 
   SysTick->VAL   = 0UL;                                            
   SysTick->CTRL  = SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;  
@@ -24,7 +32,67 @@ void systick_init()
  */
 uint32_t systick_get_tick_count()
 {
-	return tick_count;
+	return (uint32_t)tick_count;
+}
+
+/*
+ * Return the current tick count extended to 64 bits (it never wraps around)
+ */
+uint64_t systick_get_tick_count64()
+{
+	uint32_t irq_state = kernel_enter_critical();
+	uint64_t ticks;
+	
+	ticks = tick_count;
+	kernel_exit_critical(irq_state);
+	return ticks;
+}
+
+/*
+ * Get the tick count and the SysTick counts elapsed in the current tick period.
+ * If the counter already wrapped but the tick interrupt is still pending, the missing 
+ * tick is accounted here, so that the time never goes backwards.
+ */
+static void systick_get_time(uint64_t* ticks, uint32_t* elapsed_counts)
+{
+	uint32_t irq_state = kernel_enter_critical();
+	uint32_t counter_value;
+	
+	*ticks = tick_count;
+	counter_value = SysTick->VAL;
+	if (ARE_BITS_SET(SCB->ICSR, SCB_ICSR_PENDSTSET_Msk)) {
+		(*ticks)++;
+		counter_value = SysTick->VAL;
+	}
+	kernel_exit_critical(irq_state);
+	
+	// The counter counts down and reaches 0 exactly on the tick boundary
+	*elapsed_counts = (counter_value == 0) ? 0 : (counts_per_tick - counter_value);
+}
+
+/*
+ * Return the time elapsed since boot in microseconds, combining the tick count with
+ * the current value of the SysTick down-counter
+ */
+uint64_t systick_get_time_us()
+{
+	uint64_t ticks;
+	uint32_t elapsed_counts;
+	
+	systick_get_time(&ticks, &elapsed_counts);
+	return (ticks * US_PER_TICK) + ((elapsed_counts * US_PER_TICK) / counts_per_tick);
+}
+
+/*
+ * Return the time elapsed since boot in nanoseconds (the resolution is one SysTick count)
+ */
+uint64_t systick_get_time_ns()
+{
+	uint64_t ticks;
+	uint32_t elapsed_counts;
+	
+	systick_get_time(&ticks, &elapsed_counts);
+	return (ticks * NS_PER_TICK) + (((uint64_t)elapsed_counts * NS_PER_TICK) / counts_per_tick);
 }
 
 /*
@@ -37,9 +105,95 @@ void systick_blocking_delay(uint32_t ticks)
 }
 
 /*
- * SysTick handler - Just increment the counter
+ * Stop the periodic tick and sleep (WFI) until the desired amount of ticks is elapsed or
+ * until another interrupt wakes the core up. Interrupts must be disabled by the caller
+ * (PRIMASK): the core wakes up anyway, but pending handlers run only once the tick count 
+ * has been corrected. Returns the number of ticks elapsed while sleeping, which are 
+ * already added to the tick count.
+ * SysTick is stopped for a few cycles while it is reprogrammed: that time is measured 
+ * with the cycle counter (which runs since the core is awake) and added back to the 
+ * elapsed time, so the tick count does not drift.
+ */
+uint32_t systick_sleep(uint32_t ticks)
+{
+	uint32_t ctrl, reload, elapsed_counts, elapsed_ticks, remaining_counts;
+	uint32_t counts_already_elapsed, stop_cycle;
+	
+	// A tick is already pending: it must be processed first
+	if (ARE_BITS_SET(SCB->ICSR, SCB_ICSR_PENDSTSET_Msk) || (ticks < KERNEL_TICKLESS_IDLE_MIN_TICKS)) {
+		return 0;
+	}
+	if (ticks > max_sleep_ticks) {
+		ticks = max_sleep_ticks;
+	}
+	
+	// Stop the counter and program it so that it expires at the requested tick boundary
+	// (part of the current tick period is already elapsed)
+	ctrl = SysTick->CTRL & ~SysTick_CTRL_ENABLE_Msk;
+	SysTick->CTRL = ctrl;
+	stop_cycle = DWT->CYCCNT;
+	// The counter may have expired just before being stopped
+	if (ARE_BITS_SET(SCB->ICSR, SCB_ICSR_PENDSTSET_Msk)) {
+		SysTick->CTRL = ctrl | SysTick_CTRL_ENABLE_Msk;
+		stopped_cycles += DWT->CYCCNT - stop_cycle;
+		return 0;
+	}
+	counts_already_elapsed = counts_per_tick - SysTick->VAL;
+	reload = (ticks * counts_per_tick) - counts_already_elapsed;
+	SysTick->LOAD = reload;
+	SysTick->VAL = 0UL;
+	SysTick->CTRL = ctrl | SysTick_CTRL_ENABLE_Msk;
+	stopped_cycles += DWT->CYCCNT - stop_cycle;
+	
+	__DSB();
+	__WFI();
+	__ISB();
+	
+	// Stop the counter first and then check how much time elapsed: reading CTRL clears
+	// COUNTFLAG, so reading it while the counter runs could miss an expiration. The
+	// pending tick interrupt also tells that the period elapsed.
+	SysTick->CTRL = ctrl;
+	stop_cycle = DWT->CYCCNT;
+	if (ARE_BITS_SET(SysTick->CTRL, SysTick_CTRL_COUNTFLAG_Msk) || 
+		ARE_BITS_SET(SCB->ICSR, SCB_ICSR_PENDSTSET_Msk)) {
+		// The whole period elapsed: the pending tick interrupt is accounted here
+		SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+		elapsed_counts = reload;
+	} else {
+		// Some other interrupt woke the core up
+		elapsed_counts = reload - SysTick->VAL;
+	}
+	elapsed_counts += counts_already_elapsed;
+	// add back the time during which the counter was stopped (the cycles left over are 
+	// accounted at the next sleep, together with the ones needed to restart the counter)
+	stopped_cycles += DWT->CYCCNT - stop_cycle;
+	elapsed_counts += stopped_cycles / CYCLES_PER_COUNT;
+	stopped_cycles %= CYCLES_PER_COUNT;
+	elapsed_ticks = elapsed_counts / counts_per_tick;
+	remaining_counts = counts_per_tick - (elapsed_counts % counts_per_tick);
+	if (remaining_counts < 2) {
+		remaining_counts += counts_per_tick;
+	}
+	
+	// Restart the counter so that the next interrupt falls on the next tick boundary, 
+	// then restore the normal period for the following ones
+	stop_cycle = DWT->CYCCNT;
+	SysTick->LOAD = remaining_counts - 1UL;
+	SysTick->VAL = 0UL;
+	SysTick->CTRL = ctrl | SysTick_CTRL_ENABLE_Msk;
+	stopped_cycles += DWT->CYCCNT - stop_cycle;
+	while (SysTick->VAL == 0);
+	SysTick->LOAD = counts_per_tick - 1UL;
+	
+	tick_count += elapsed_ticks;
+	return elapsed_ticks;
+}
+
+/*
+ * SysTick handler - Increment the counter and let the kernel wake up the expired tasks
  */
 __attribute__((interrupt)) void systick_handler()
 {
 	tick_count++;
+	kernel_process_ticks(1);
 }
\ No newline at end of file
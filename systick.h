@@ -1,9 +1,16 @@
 #ifndef _SYSTICK_H_
 #define _SYSTICK_H_
 
+/* 1 ms per tick. */
+#define TICK_RATE_HZ	1000
+
 void systick_init(void);
 uint32_t systick_get_tick_count(void);
+uint64_t systick_get_tick_count64(void);
+uint64_t systick_get_time_us(void);
+uint64_t systick_get_time_ns(void);
 void systick_blocking_delay(uint32_t ticks);
+uint32_t systick_sleep(uint32_t ticks);
 
 void systick_handler(void);
 
@@ -4,30 +4,35 @@
 
 #define debug_msg(_format_, ...)	DebugPrintf("[Test] " _format_, ##__VA_ARGS__)
 
-void task1_func(void* arg)
+int32_t task1_func(void* arg)
 {
 	debug_msg("[#1] starting\n");
 	while (1) {
-		debug_msg("[#1] running\n");
+		debug_msg("[#1] running - CPU load %d/1000 (1s) %d/1000 (10s) %d/1000 (60s)\n", 
+					kernel_get_cpu_load(1), kernel_get_cpu_load(10), kernel_get_cpu_load(60));
 		kernel_task_sleep(500);
 	}
 	debug_msg("[#1] terminating\n");
+	return 0;
 }
 ALLOCATE_TASK(task1, 512, 1, &task1_func)
 
-void task2_func(void* arg)
+int32_t task2_func(void* arg)
 {
+	int32_t exit_code;
+	
 	while (1) {
-		if (kernel_get_task_status(&task1) == TASK_STATE_DEAD) {
-			debug_msg("[#2] resuming task 1\n");
+		// restart task 1 as soon as it terminates
+		if (kernel_task_join(&task1, WAIT_FOREVER, &exit_code) == KERNEL_OK) {
+			debug_msg("[#2] task 1 exited with code %d, resuming it\n", exit_code);
 			kernel_activate_task_immediately(&task1);
 		}
-		kernel_task_sleep(2000);
+		kernel_task_sleep(0);
 	}
 }
 ALLOCATE_TASK(task2, 512, 2, &task2_func)
 
-void task3_func(void* arg)
+int32_t task3_func(void* arg)
 {
 	while (1) {
 		if (kernel_get_task_status(&task1) != TASK_STATE_DEAD) {
@@ -0,0 +1,279 @@
+#include "stdint.h"
+#include "stm32f103xb.h"
+#include "kernel.h"
+#include "tlsf.h"
+
+// Every block starts with this header. The free list pointers are only valid while the
+// block is free, so they overlap the payload of the allocated blocks.
+struct TLSF_BLOCK {
+	struct TLSF_BLOCK* prev_phys_block;	// previous block in memory (NULL for the first one)
+	uint32_t size;	// size of the payload (in bytes); bit 0 is set when the block is free
+	struct TLSF_BLOCK* next_free;
+	struct TLSF_BLOCK* prev_free;
+};
+
+#define BLOCK_FREE				0x1UL
+#define BLOCK_HEADER_SIZE		(sizeof(struct TLSF_BLOCK*) + sizeof(uint32_t))
+#define BLOCK_MIN_SIZE			(2 * sizeof(struct TLSF_BLOCK*))
+#define BLOCK_MAX_SIZE			((1UL << TLSF_FL_INDEX_MAX) - (1UL << TLSF_ALIGN_LOG2))	// largest size mapped to a list
+#define SMALL_BLOCK_SIZE		(1UL << TLSF_FL_INDEX_SHIFT)
+#define ALIGN_MASK				((1UL << TLSF_ALIGN_LOG2) - 1)
+
+#define block_size(_block_)		((_block_)->size & ~BLOCK_FREE)
+#define block_is_free(_block_)	(((_block_)->size & BLOCK_FREE) != 0)
+#define block_payload(_block_)	((void*)((uint8_t*)(_block_) + BLOCK_HEADER_SIZE))
+#define block_next(_block_)		((struct TLSF_BLOCK*)((uint8_t*)block_payload(_block_) + block_size(_block_)))
+
+/*
+ * Index of the most/least significant bit set (the value must not be 0)
+ */
+#define fls(_x_)		(31 - __CLZ(_x_))
+#define ffs(_x_)		(31 - __CLZ((_x_) & (~(_x_) + 1)))
+
+/*
+ * Compute the indexes of the list which holds the blocks of the given size
+ */
+static void tlsf_mapping(uint32_t size, uint32_t* fl, uint32_t* sl)
+{
+	uint32_t msb;
+	
+	if (size < SMALL_BLOCK_SIZE) {
+		*fl = 0;
+		*sl = size >> TLSF_ALIGN_LOG2;
+	} else {
+		msb = fls(size);
+		*sl = (size >> (msb - TLSF_SL_INDEX_LOG2)) ^ TLSF_SL_COUNT;
+		*fl = msb - TLSF_FL_INDEX_SHIFT + 1;
+	}
+}
+
+/*
+ * Find the first non-empty list whose blocks are all at least as large as the list [fl][sl]
+ * ones. The search uses only the bitmaps, so it takes constant time.
+ */
+static struct TLSF_BLOCK* tlsf_find_suitable_block(struct TLSF* tlsf, uint32_t* fl, uint32_t* sl)
+{
+	uint32_t sl_map, fl_map;
+	
+	if (*fl >= TLSF_FL_COUNT) {
+		return NULL;
+	}
+	sl_map = tlsf->sl_bitmap[*fl] & (0xFFFFFFFFUL << *sl);
+	if (sl_map == 0) {
+		// no large enough block in this first level: take a block from the next non-empty one
+		fl_map = (*fl + 1 < 32) ? (tlsf->fl_bitmap & (0xFFFFFFFFUL << (*fl + 1))) : 0;
+		if (fl_map == 0) {
+			return NULL;
+		}
+		*fl = ffs(fl_map);
+		sl_map = tlsf->sl_bitmap[*fl];
+	}
+	*sl = ffs(sl_map);
+	return tlsf->free_blocks[*fl][*sl];
+}
+
+/*
+ * Add the free block to the head of its list
+ */
+static void tlsf_insert_free_block(struct TLSF* tlsf, struct TLSF_BLOCK* block)
+{
+	uint32_t fl, sl;
+	
+	tlsf_mapping(block_size(block), &fl, &sl);
+	block->prev_free = NULL;
+	block->next_free = tlsf->free_blocks[fl][sl];
+	if (block->next_free != NULL) {
+		block->next_free->prev_free = block;
+	}
+	tlsf->free_blocks[fl][sl] = block;
+	tlsf->fl_bitmap |= (1UL << fl);
+	tlsf->sl_bitmap[fl] |= (1UL << sl);
+}
+
+/*
+ * Remove the free block from its list
+ */
+static void tlsf_remove_free_block(struct TLSF* tlsf, struct TLSF_BLOCK* block)
+{
+	uint32_t fl, sl;
+	
+	tlsf_mapping(block_size(block), &fl, &sl);
+	if (block->prev_free != NULL) {
+		block->prev_free->next_free = block->next_free;
+	} else {
+		tlsf->free_blocks[fl][sl] = block->next_free;
+	}
+	if (block->next_free != NULL) {
+		block->next_free->prev_free = block->prev_free;
+	}
+	if (tlsf->free_blocks[fl][sl] == NULL) {
+		tlsf->sl_bitmap[fl] &= ~(1UL << sl);
+		if (tlsf->sl_bitmap[fl] == 0) {
+			tlsf->fl_bitmap &= ~(1UL << fl);
+		}
+	}
+}
+
+/*
+ * Initialize the allocator on the given memory area. The last header of the area is a 
+ * zero sized allocated block, so that the last real block never merges with it.
+ * Free blocks can't be larger than BLOCK_MAX_SIZE, so larger areas are split into
+ * several blocks.
+ */
+void tlsf_init(struct TLSF* tlsf, void* memory, uint32_t size)
+{
+	uint32_t start = ((uint32_t)memory + ALIGN_MASK) & ~ALIGN_MASK;
+	uint32_t end = ((uint32_t)memory + size) & ~ALIGN_MASK;
+	struct TLSF_BLOCK* block = (struct TLSF_BLOCK*)start;
+	struct TLSF_BLOCK* prev_block = NULL;
+	uint32_t remaining, block_size;
+	uint32_t fl, sl;
+	
+	tlsf->fl_bitmap = 0;
+	for (fl = 0; fl < TLSF_FL_COUNT; fl++) {
+		tlsf->sl_bitmap[fl] = 0;
+		for (sl = 0; sl < TLSF_SL_COUNT; sl++) {
+			tlsf->free_blocks[fl][sl] = NULL;
+		}
+	}
+	tlsf->total_size = 0;
+	tlsf->used_size = 0;
+	tlsf->max_used_size = 0;
+	tlsf->failures = 0;
+	if ((end <= start) || ((end - start) < (2 * BLOCK_HEADER_SIZE + BLOCK_MIN_SIZE))) {
+		return;
+	}
+	
+	// room for the blocks, the sentinel's header excluded
+	remaining = end - start - BLOCK_HEADER_SIZE;
+	while (remaining >= (BLOCK_HEADER_SIZE + BLOCK_MIN_SIZE)) {
+		block_size = remaining - BLOCK_HEADER_SIZE;
+		if (block_size > BLOCK_MAX_SIZE) {
+			block_size = BLOCK_MAX_SIZE;
+			// the rest must be either empty or large enough for another block
+			if ((remaining - BLOCK_HEADER_SIZE - block_size) < (BLOCK_HEADER_SIZE + BLOCK_MIN_SIZE)) {
+				block_size -= BLOCK_HEADER_SIZE + BLOCK_MIN_SIZE;
+			}
+		}
+		block->prev_phys_block = prev_block;
+		block->size = block_size | BLOCK_FREE;
+		tlsf_insert_free_block(tlsf, block);
+		tlsf->total_size += block_size;
+		remaining -= BLOCK_HEADER_SIZE + block_size;
+		prev_block = block;
+		block = block_next(block);
+	}
+	// sentinel
+	block->prev_phys_block = prev_block;
+	block->size = 0;
+}
+
+/*
+ * Allocate a block of at least size bytes (8 bytes aligned) in constant time: the request
+ * is rounded up to the next list size, so that any block of the first non-empty list
+ * found through the bitmaps fits, and the remainder of the block is split off.
+ * Returns NULL if there's no large enough free block.
+ */
+void* tlsf_malloc(struct TLSF* tlsf, uint32_t size)
+{
+	struct TLSF_BLOCK* block = NULL;
+	struct TLSF_BLOCK* remainder;
+	uint32_t search_size, fl, sl;
+	
+	if ((size > 0) && (size < (1UL << TLSF_FL_INDEX_MAX))) {
+		size = (size + ALIGN_MASK) & ~ALIGN_MASK;
+		if (size < BLOCK_MIN_SIZE) {
+			size = BLOCK_MIN_SIZE;
+		}
+		search_size = size;
+		if (size >= SMALL_BLOCK_SIZE) {
+			search_size += (1UL << (fls(size) - TLSF_SL_INDEX_LOG2)) - 1;
+		}
+		tlsf_mapping(search_size, &fl, &sl);
+		block = tlsf_find_suitable_block(tlsf, &fl, &sl);
+	}
+	if (block == NULL) {
+		tlsf->failures++;
+		return NULL;
+	}
+	
+	tlsf_remove_free_block(tlsf, block);
+	if (block_size(block) >= (size + BLOCK_HEADER_SIZE + BLOCK_MIN_SIZE)) {
+		remainder = (struct TLSF_BLOCK*)((uint8_t*)block_payload(block) + size);
+		remainder->prev_phys_block = block;
+		remainder->size = (block_size(block) - size - BLOCK_HEADER_SIZE) | BLOCK_FREE;
+		block_next(remainder)->prev_phys_block = remainder;
+		block->size = size;
+		tlsf_insert_free_block(tlsf, remainder);
+	}
+	block->size &= ~BLOCK_FREE;
+	
+	tlsf->used_size += block_size(block) + BLOCK_HEADER_SIZE;
+	if (tlsf->used_size > tlsf->max_used_size) {
+		tlsf->max_used_size = tlsf->used_size;
+	}
+	return block_payload(block);
+}
+
+/*
+ * Give the block back in constant time, merging it with the adjacent free blocks
+ */
+void tlsf_free(struct TLSF* tlsf, void* ptr)
+{
+	struct TLSF_BLOCK* block;
+	struct TLSF_BLOCK* adjacent;
+	
+	if (ptr == NULL) {
+		return;
+	}
+	block = (struct TLSF_BLOCK*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+	tlsf->used_size -= block_size(block) + BLOCK_HEADER_SIZE;
+	block->size |= BLOCK_FREE;
+	
+	// merged blocks must not exceed BLOCK_MAX_SIZE
+	adjacent = block->prev_phys_block;
+	if ((adjacent != NULL) && block_is_free(adjacent) && 
+		((block_size(adjacent) + BLOCK_HEADER_SIZE + block_size(block)) <= BLOCK_MAX_SIZE)) {
+		tlsf_remove_free_block(tlsf, adjacent);
+		adjacent->size += block_size(block) + BLOCK_HEADER_SIZE;
+		block = adjacent;
+		block_next(block)->prev_phys_block = block;
+	}
+	adjacent = block_next(block);
+	if (block_is_free(adjacent) && 
+		((block_size(block) + BLOCK_HEADER_SIZE + block_size(adjacent)) <= BLOCK_MAX_SIZE)) {
+		tlsf_remove_free_block(tlsf, adjacent);
+		block->size += block_size(adjacent) + BLOCK_HEADER_SIZE;
+		block_next(block)->prev_phys_block = block;
+	}
+	tlsf_insert_free_block(tlsf, block);
+}
+
+/*
+ * Get the usage and fragmentation statistics. Only the list of the largest blocks is 
+ * searched for the largest free block, so this is not constant time (but it is short).
+ */
+void tlsf_get_stats(struct TLSF* tlsf, struct TLSF_STATS* stats)
+{
+	struct TLSF_BLOCK* block;
+	uint32_t fl;
+	
+	stats->total_size = tlsf->total_size;
+	stats->used_size = tlsf->used_size;
+	stats->max_used_size = tlsf->max_used_size;
+	stats->free_size = tlsf->total_size - tlsf->used_size;
+	stats->failures = tlsf->failures;
+	stats->largest_free_block = 0;
+	if (tlsf->fl_bitmap != 0) {
+		fl = fls(tlsf->fl_bitmap);
+		block = tlsf->free_blocks[fl][fls(tlsf->sl_bitmap[fl])];
+		while (block != NULL) {
+			if (block_size(block) > stats->largest_free_block) {
+				stats->largest_free_block = block_size(block);
+			}
+			block = block->next_free;
+		}
+	}
+	stats->fragmentation = (stats->free_size == 0) ? 0 : 
+		(uint16_t)(1000 - ((uint64_t)stats->largest_free_block * 1000) / stats->free_size);
+}
@@ -0,0 +1,44 @@
+#ifndef _TLSF_H_
+#define _TLSF_H_
+
+#include "stdint.h"
+
+// Two-level segregated fit allocator: free blocks are kept in lists indexed by a first
+// level (power of 2 size range) and a second level (linear subdivision of that range),
+// with a bitmap for each level, so that both allocation and free take constant time.
+#define TLSF_ALIGN_LOG2			3	// blocks are 8 bytes aligned
+#define TLSF_SL_INDEX_LOG2		4	// 16 second level lists for each first level
+#define TLSF_FL_INDEX_MAX		15	// largest block: 32 KB
+
+#define TLSF_SL_COUNT			(1 << TLSF_SL_INDEX_LOG2)
+#define TLSF_FL_INDEX_SHIFT		(TLSF_SL_INDEX_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_FL_COUNT			(TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+
+struct TLSF_BLOCK;
+
+struct TLSF {
+	uint32_t fl_bitmap;		// bit N is set when some list of the first level N is not empty
+	uint32_t sl_bitmap[TLSF_FL_COUNT];	// bit M of word N is set when list [N][M] is not empty
+	struct TLSF_BLOCK* free_blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+	uint32_t total_size;	// bytes available for the blocks (the arena minus the first and last headers)
+	uint32_t used_size;		// bytes in allocated blocks (including their headers)
+	uint32_t max_used_size;	// highest value of used_size
+	uint32_t failures;		// number of allocations which failed
+};
+
+struct TLSF_STATS {
+	uint32_t total_size;
+	uint32_t used_size;
+	uint32_t max_used_size;
+	uint32_t free_size;
+	uint32_t largest_free_block;
+	uint16_t fragmentation;	// free memory not in the largest free block (in 1/1000)
+	uint32_t failures;
+};
+
+void tlsf_init(struct TLSF* tlsf, void* memory, uint32_t size);
+void* tlsf_malloc(struct TLSF* tlsf, uint32_t size);
+void tlsf_free(struct TLSF* tlsf, void* ptr);
+void tlsf_get_stats(struct TLSF* tlsf, struct TLSF_STATS* stats);
+
+#endif // _TLSF_H_
\ No newline at end of file